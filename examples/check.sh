@@ -0,0 +1,69 @@
+#!/bin/sh
+
+# NOTE: `check.sh main main_interp jasm`, run from the repository root by
+# `make check`. Every `examples/*.out` is what the program beside it prints,
+# dumps left out; both builds must print exactly that, `main` compiling loops
+# at its threshold and `main_interp` never. Then a cache that goes corrupt,
+# or holds a file made for another loop, must only cost a recompile, and a
+# damaged bytecode file must be rejected before anything runs.
+
+set -eu
+
+MAIN=$1
+MAIN_INTERP=$2
+JASM=$3
+
+mkdir -p build/examples/
+for x in examples/*.out; do
+    name=$(basename "$x" .out)
+    program=build/examples/$name.jbc
+    "$JASM" "examples/$name.jasm" "$program"
+    "$MAIN" -q "$program" | diff -u "$x" -
+    "$MAIN_INTERP" -q "$program" | diff -u "$x" -
+done
+
+# NOTE: `unroll` compiles two loops, so the cache holds two files.
+program=build/examples/unroll.jbc
+cache=build/examples/cache
+rm -rf "$cache"
+"$MAIN" -q "$program" "$cache" | diff -u examples/unroll.out -
+test "$("$MAIN" "$program" "$cache" | grep -c ' cached$')" -eq 2
+"$MAIN" -q "$program" "$cache" | diff -u examples/unroll.out -
+for file in "$cache"/*.jit; do
+    printf 'x' >>"$file"
+done
+"$MAIN" -q "$program" "$cache" | diff -u examples/unroll.out -
+test "$("$MAIN" "$program" "$cache" | grep -c ' cached$')" -eq 2
+set -- "$cache"/*.jit
+cp "$1" "$2"
+"$MAIN" -q "$program" "$cache" | diff -u examples/unroll.out -
+
+# NOTE: Offsets into `BytecodeHeader`, whose fields are all `u32`.
+program=build/examples/closed.jbc
+bad=build/examples/bad.jbc
+size=$(wc -c <"$program")
+corrupt() {
+    cp "$program" "$bad"
+    printf '\377' | dd of="$bad" bs=1 seek="$1" conv=notrunc 2>/dev/null
+}
+reject() {
+    if "$MAIN" -q "$bad" >/dev/null 2>&1; then
+        echo "$bad: $1 accepted" >&2
+        exit 1
+    fi
+}
+corrupt 0
+reject magic
+corrupt 4
+reject version
+head -c 16 "$program" >"$bad"
+reject header
+head -c $((size - 1)) "$program" >"$bad"
+reject size
+cp "$program" "$bad"
+printf '\0\0\0\0' | dd of="$bad" bs=1 seek=20 conv=notrunc 2>/dev/null
+reject locals
+len=$(od -An -tu4 -j8 -N4 "$program")
+len_chars=$(od -An -tu4 -j24 -N4 "$program")
+corrupt $((size - len_chars - len))
+reject type
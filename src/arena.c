@@ -0,0 +1,26 @@
+#include "arena.h"
+
+#include <sys/mman.h>
+
+void* arena_alloc(Arena* arena, u64 size, u64 align) {
+    if (arena->buffer == NULL) {
+        void* buffer = mmap(NULL,
+                            ARENA_RESERVE,
+                            PROT_READ | PROT_WRITE,
+                            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE,
+                            -1,
+                            0);
+        EXIT_IF(buffer == MAP_FAILED);
+        arena->buffer = buffer;
+        arena->len = 0;
+    }
+    const u64 start = (arena->len + (align - 1)) & ~(align - 1);
+    EXIT_IF(ARENA_RESERVE < start);
+    EXIT_IF((ARENA_RESERVE - start) < size);
+    arena->len = start + size;
+    return &arena->buffer[start];
+}
+
+void arena_reset(Arena* arena) {
+    arena->len = 0;
+}
@@ -0,0 +1,27 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "prelude.h"
+
+// NOTE: A bump allocator over one reserved span of address space. Pages are
+// only committed once touched, so an arena grows in place without ever
+// moving what it has handed out, and `arena_reset` is a single store.
+typedef struct {
+    u8* buffer;
+    u64 len;
+} Arena;
+
+#define ARENA_RESERVE (1lu << 32)
+
+// NOTE: The lowest set bit of `sizeof(type)`; a power of two that the real
+// alignment always divides, and one that keeps consecutive allocations of
+// the same type contiguous.
+#define ARENA_ALIGN(type) (sizeof(type) & (~sizeof(type) + 1))
+
+#define ARENA_ALLOC(arena, type, n) \
+    ((type*)arena_alloc(arena, sizeof(type) * (n), ARENA_ALIGN(type)))
+
+void* arena_alloc(Arena*, u64, u64);
+void  arena_reset(Arena*);
+
+#endif
@@ -1,15 +1,36 @@
 #include "asm.h"
+#include "table.h"
 
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 
+// NOTE: Each register's value is its hardware encoding.
 typedef enum {
-    ASM_REG_RDI = 0,
+    ASM_REG_RAX = 0,
+    ASM_REG_RCX,
+    ASM_REG_RDX,
+    ASM_REG_RBX,
+    ASM_REG_RSP,
+    ASM_REG_RBP,
+    ASM_REG_RSI,
+    ASM_REG_RDI,
     ASM_REG_R8,
+    ASM_REG_R9,
+    ASM_REG_R10,
+    ASM_REG_R11,
+    ASM_REG_R12,
+    ASM_REG_R13,
+    ASM_REG_R14,
+    ASM_REG_R15,
 } AsmArgReg;
 
+// NOTE: `[base + (index * scale) + offset]`; a `scale` of `0` means there is
+// no index.
 typedef struct {
-    AsmArgReg reg;
+    AsmArgReg base;
+    AsmArgReg index;
+    u8        scale;
     i32       offset;
 } AsmArgAddr;
 
@@ -19,6 +40,8 @@ typedef struct {
         AsmArgReg   as_reg;
         AsmArgAddr  as_addr;
         i32         as_i32;
+        i64         as_i64;
+        u32         as_vreg;
     } value;
     enum {
         ASM_ARG_NONE = 0,
@@ -26,122 +49,183 @@ typedef struct {
         ASM_ARG_REG = 1 << 1,
         ASM_ARG_ADDR = 1 << 2,
         ASM_ARG_I32 = 1 << 3,
+        ASM_ARG_I64 = 1 << 4,
+        ASM_ARG_VREG = 1 << 5,
     } type;
 } AsmArg;
 
-typedef struct {
-    AsmArg args[2];
-    enum {
-        ASM_NOP = 0,
+typedef enum {
+    ASM_NOP = 0,
 
-        ASM_RET,
+    ASM_RET,
 
-        ASM_LABEL,
+    ASM_LABEL,
 
-        ASM_MOV,
+    ASM_MOV,
 
-        ASM_JMP,
-        ASM_JNZ,
-        ASM_JGE,
+    ASM_JMP,
+    ASM_JZ,
+    ASM_JNZ,
+    ASM_JGE,
+    ASM_JL,
 
-        ASM_TEST,
-        ASM_CMP,
+    ASM_TEST,
+    ASM_CMP,
 
-        ASM_AND,
+    ASM_SETL,
+    ASM_SETE,
 
-        ASM_ADD,
-    } type;
-} Asm;
+    ASM_CMOVL,
+    ASM_CMOVZ,
+    ASM_CMOVNZ,
+
+    ASM_AND,
+
+    ASM_ADD,
+    ASM_SUB,
+    ASM_IMUL,
+
+    ASM_SHR,
+
+    ASM_PUSH,
+    ASM_POP,
+} AsmType;
 
 typedef struct {
-    const char* key;
-    union {
-        AsmArgReg as_reg;
-        u8*       as_bytes;
-    } value;
-} KeyValue;
+    AsmArg  args[2];
+    AsmType type;
+} Asm;
+
+// NOTE: `ASMS` grows one `asm_alloc` at a time, so it gets an arena of its
+// own and stays contiguous; every other table is sized up front out of
+// `ARENA_ASM`. Both are reset by every `asm_emit`.
+static Arena ARENA_ASMS = {0};
+static Arena ARENA_ASM = {0};
+
+static Asm* ASMS = NULL;
+static u32  LEN_ASMS = 0;
 
-#define CAP_ASMS (1 << 5)
-static Asm ASMS[CAP_ASMS];
-static u32 LEN_ASMS = 0;
+// NOTE: The longest x86-64 instruction.
+#define CAP_ASM_BYTES 15
 
-#define CAP_BYTES (1 << 6)
-static u8  BYTES[CAP_BYTES];
+static u8* BYTES = NULL;
 static u32 LEN_BYTES = 0;
 
-#define CAP_ASM_LABELS (1 << 4)
-static KeyValue ASM_LABELS[CAP_ASM_LABELS];
-static u32      LEN_ASM_LABELS = 0;
+// NOTE: Every function `asm_jit` makes is carved out of one span of address
+// space, reserved up front, rather than mapped on its own. The span is a
+// memory file mapped twice: `CODE` is writable and `CODE_EXEC` executable,
+// so neither view ever allows both, and placing a function is a copy with
+// no `mprotect` at all. A `CodeSpan` ahead of every function records its own
+// extent, so `asm_free` can hand it back to `CODE_FREES`, which `asm_jit`
+// looks in first. `CODE_FREES` is kept in order of offset, with no two spans
+// touching and none at the very end, which goes back to `LEN_CODE` instead.
+typedef struct {
+    u32 offset;
+    u32 len;
+} CodeSpan;
 
-#define CAP_PATCHES (1 << 4)
-static KeyValue PATCHES[CAP_PATCHES];
-static u32      LEN_PATCHES = 0;
+#define CODE_RESERVE (1lu << 30)
+#define CODE_ALIGN   16lu
 
-#define CAP_PTRS (1 << 3)
-static KeyValue PTRS[CAP_PTRS];
-static u32      LEN_PTRS = 0;
+STATIC_ASSERT(sizeof(CodeSpan) <= CODE_ALIGN);
 
-static AsmArgReg REGS[] = {
-    ASM_REG_RDI,
+// NOTE: `CODE_FREES` grows one span at a time, so it gets an arena of its
+// own and stays contiguous; it is never reset.
+static Arena ARENA_CODE_FREES = {0};
+
+static u8*       CODE = NULL;
+static u8*       CODE_EXEC = NULL;
+static u64       LEN_CODE = 0;
+static CodeSpan* CODE_FREES = NULL;
+static u32       LEN_CODE_FREES = 0;
+static u32       CAP_CODE_FREES = 0;
+
+// NOTE: Maps a label to the index of its `Asm`.
+static Table ASM_LABELS = {0};
+
+// NOTE: All indexed by `Asm`. `OFFSETS` is where each one starts in `BYTES`,
+// with one more entry for the end; `TARGETS` is the `Asm` a jump lands on and
+// `FAR` marks jumps that need a 32-bit displacement.
+static u32*  OFFSETS = NULL;
+static u32*  TARGETS = NULL;
+static Bool* FAR = NULL;
+
+// NOTE: Allocatable registers, caller-saved first so that a callee-saved one
+// is only pushed and popped once pressure calls for it. `rdi` always holds
+// the frame, and `rax` is left free for the exit index and for shuffling
+// spilled operands.
+static const AsmArgReg REGS[] = {
+    ASM_REG_RCX,
+    ASM_REG_RDX,
+    ASM_REG_RSI,
     ASM_REG_R8,
+    ASM_REG_R9,
+    ASM_REG_R10,
+    ASM_REG_R11,
+    ASM_REG_RBX,
+    ASM_REG_RBP,
+    ASM_REG_R12,
+    ASM_REG_R13,
+    ASM_REG_R14,
+    ASM_REG_R15,
 };
 
 #define CAP_REGS (sizeof(REGS) / sizeof(REGS[0]))
-static u32 LEN_REGS = 0;
 
-static Asm* asm_alloc(void) {
-    EXIT_IF(CAP_ASMS <= LEN_ASMS);
-    return &ASMS[LEN_ASMS++];
+static Bool reg_is_saved(AsmArgReg reg) {
+    return (reg == ASM_REG_RBX) || (reg == ASM_REG_RBP) ||
+           ((ASM_REG_R12 <= reg) && (reg <= ASM_REG_R15));
 }
 
-static AsmArgReg reg_alloc(void) {
-    EXIT_IF(CAP_REGS <= LEN_REGS);
-    return REGS[LEN_REGS++];
+// NOTE: Lowering hands out a fresh virtual register for every value and
+// temporary; `asms_allocate` maps each onto a register or a stack slot.
+static u32 LEN_VREGS = 0;
+
+// NOTE: Indexed by `IrValue`; the virtual register each is computed into, and
+// how many operands, branches, and exits read it.
+static u32* VREGS = NULL;
+static u32* USES = NULL;
+
+// NOTE: Indexed by `IrBlock`.
+static const char** LABELS = NULL;
+
+static Asm* asm_alloc(void) {
+    Asm* asm = ARENA_ALLOC(&ARENA_ASMS, Asm, 1);
+    *asm = (Asm){0};
+    ++LEN_ASMS;
+    return asm;
 }
 
-static KeyValue* ptr_alloc(void) {
-    EXIT_IF(CAP_PTRS <= LEN_PTRS);
-    return &PTRS[LEN_PTRS++];
+static AsmArg vreg_alloc(void) {
+    return (AsmArg){.value = {.as_vreg = LEN_VREGS++}, .type = ASM_ARG_VREG};
 }
 
 static void byte_push(u8 byte) {
-    EXIT_IF(CAP_BYTES <= LEN_BYTES);
     BYTES[LEN_BYTES++] = byte;
 }
 
-static void asm_label_push(const char* key) {
-    EXIT_IF(CAP_ASM_LABELS <= LEN_ASM_LABELS);
-    for (u32 i = 0; i < LEN_ASM_LABELS; ++i) {
-        EXIT_IF(eq(ASM_LABELS[i].key, key));
-    }
-    ASM_LABELS[LEN_ASM_LABELS++] = (KeyValue){
-        .key = key,
-        .value = {.as_bytes = &BYTES[LEN_BYTES]},
-    };
-}
-
-static void patch_push(const char* key) {
-    EXIT_IF(CAP_PATCHES <= LEN_PATCHES);
-    PATCHES[LEN_PATCHES++] = (KeyValue){
-        .key = key,
-        .value = {.as_bytes = &BYTES[LEN_BYTES]},
-    };
-}
+static const char* const REG_NAMES[] = {
+    [ASM_REG_RAX] = "rax",
+    [ASM_REG_RCX] = "rcx",
+    [ASM_REG_RDX] = "rdx",
+    [ASM_REG_RBX] = "rbx",
+    [ASM_REG_RSP] = "rsp",
+    [ASM_REG_RBP] = "rbp",
+    [ASM_REG_RSI] = "rsi",
+    [ASM_REG_RDI] = "rdi",
+    [ASM_REG_R8] = "r8",
+    [ASM_REG_R9] = "r9",
+    [ASM_REG_R10] = "r10",
+    [ASM_REG_R11] = "r11",
+    [ASM_REG_R12] = "r12",
+    [ASM_REG_R13] = "r13",
+    [ASM_REG_R14] = "r14",
+    [ASM_REG_R15] = "r15",
+};
 
 static void asm_arg_reg_print(AsmArgReg reg) {
-    switch (reg) {
-    case ASM_REG_RDI: {
-        printf("rdi");
-        break;
-    }
-    case ASM_REG_R8: {
-        printf("r8");
-        break;
-    }
-    default: {
-        EXIT();
-    }
-    }
+    EXIT_IF(ASM_REG_R15 < reg);
+    printf("%s", REG_NAMES[reg]);
 }
 
 static void asm_arg_print(AsmArg arg) {
@@ -159,7 +243,12 @@ static void asm_arg_print(AsmArg arg) {
     }
     case ASM_ARG_ADDR: {
         putchar('[');
-        asm_arg_reg_print(arg.value.as_addr.reg);
+        asm_arg_reg_print(arg.value.as_addr.base);
+        if (arg.value.as_addr.scale != 0) {
+            printf(" + ");
+            asm_arg_reg_print(arg.value.as_addr.index);
+            printf("*%u", arg.value.as_addr.scale);
+        }
         if (arg.value.as_addr.offset < 0) {
             printf(" - %d", -arg.value.as_addr.offset);
         } else if (0 < arg.value.as_addr.offset) {
@@ -172,6 +261,14 @@ static void asm_arg_print(AsmArg arg) {
         printf("%d", arg.value.as_i32);
         break;
     }
+    case ASM_ARG_I64: {
+        printf("%ld", arg.value.as_i64);
+        break;
+    }
+    case ASM_ARG_VREG: {
+        printf("v%u", arg.value.as_vreg);
+        break;
+    }
     default: {
         EXIT();
     }
@@ -203,6 +300,10 @@ static void asm_println(Asm* asm) {
         printf("        jmp %s\n", asm->args[0].value.as_chars);
         break;
     }
+    case ASM_JZ: {
+        printf("        jz %s\n", asm->args[0].value.as_chars);
+        break;
+    }
     case ASM_JNZ: {
         printf("        jnz %s\n", asm->args[0].value.as_chars);
         break;
@@ -211,6 +312,10 @@ static void asm_println(Asm* asm) {
         printf("        jge %s\n", asm->args[0].value.as_chars);
         break;
     }
+    case ASM_JL: {
+        printf("        jl %s\n", asm->args[0].value.as_chars);
+        break;
+    }
     case ASM_TEST: {
         printf("        test ");
         asm_arg_print(asm->args[0]);
@@ -227,6 +332,18 @@ static void asm_println(Asm* asm) {
         putchar('\n');
         break;
     }
+    case ASM_SETL: {
+        printf("        setl ");
+        asm_arg_print(asm->args[0]);
+        putchar('\n');
+        break;
+    }
+    case ASM_SETE: {
+        printf("        sete ");
+        asm_arg_print(asm->args[0]);
+        putchar('\n');
+        break;
+    }
     case ASM_AND: {
         printf("        and ");
         asm_arg_print(asm->args[0]);
@@ -243,308 +360,412 @@ static void asm_println(Asm* asm) {
         putchar('\n');
         break;
     }
-    default: {
-        EXIT();
+    case ASM_SUB: {
+        printf("        sub ");
+        asm_arg_print(asm->args[0]);
+        printf(", ");
+        asm_arg_print(asm->args[1]);
+        putchar('\n');
+        break;
     }
+    case ASM_IMUL: {
+        printf("        imul ");
+        asm_arg_print(asm->args[0]);
+        printf(", ");
+        asm_arg_print(asm->args[1]);
+        putchar('\n');
+        break;
     }
-}
-
-static void expr_to_asm_arg(const Expr* expr, AsmArg* arg) {
-    switch (expr->type) {
-    case EXPR_I64: {
-        EXIT_IF(0xFFFFFFFF < expr->values[0].as_i64);
-        arg->value.as_i32 = expr->values[0].as_i32;
-        arg->type = ASM_ARG_I32;
+    case ASM_CMOVL: {
+        printf("        cmovl ");
+        asm_arg_print(asm->args[0]);
+        printf(", ");
+        asm_arg_print(asm->args[1]);
+        putchar('\n');
         break;
     }
-    case EXPR_LOAD: {
-        for (u32 i = 0; i < LEN_PTRS; ++i) {
-            if (eq(expr->values[0].as_chars, PTRS[i].key)) {
-                arg->value.as_addr = (AsmArgAddr){
-                    .reg = PTRS[i].value.as_reg,
-                    .offset = 0,
-                };
-                arg->type = ASM_ARG_ADDR;
-                return;
-            }
-        }
-        EXIT();
+    case ASM_CMOVZ: {
+        printf("        cmovz ");
+        asm_arg_print(asm->args[0]);
+        printf(", ");
+        asm_arg_print(asm->args[1]);
+        putchar('\n');
+        break;
     }
-    case EXPR_AND: {
-        AsmArgReg reg = reg_alloc();
-        {
-            Asm* asm = asm_alloc();
-            asm->args[0].value.as_reg = reg;
-            asm->args[0].type = ASM_ARG_REG;
-            expr_to_asm_arg(expr->values[0].as_expr, &asm->args[1]);
-            asm->type = ASM_MOV;
-        }
-        {
-            Asm* asm = asm_alloc();
-            asm->args[0].value.as_reg = reg;
-            asm->args[0].type = ASM_ARG_REG;
-            expr_to_asm_arg(expr->values[1].as_expr, &asm->args[1]);
-            asm->type = ASM_AND;
-        }
-        arg->value.as_reg = reg;
-        arg->type = ASM_ARG_REG;
-        return;
+    case ASM_CMOVNZ: {
+        printf("        cmovnz ");
+        asm_arg_print(asm->args[0]);
+        printf(", ");
+        asm_arg_print(asm->args[1]);
+        putchar('\n');
+        break;
+    }
+    case ASM_SHR: {
+        printf("        shr ");
+        asm_arg_print(asm->args[0]);
+        printf(", ");
+        asm_arg_print(asm->args[1]);
+        putchar('\n');
+        break;
+    }
+    case ASM_PUSH: {
+        printf("        push ");
+        asm_arg_print(asm->args[0]);
+        putchar('\n');
+        break;
+    }
+    case ASM_POP: {
+        printf("        pop ");
+        asm_arg_print(asm->args[0]);
+        putchar('\n');
+        break;
     }
-    case EXPR_IDENT:
-    case EXPR_RET:
-    case EXPR_LABEL:
-    case EXPR_STORE:
-    case EXPR_JMP:
-    case EXPR_JZ:
-    case EXPR_LT:
-    case EXPR_EQ:
-    case EXPR_ADD:
     default: {
         EXIT();
     }
     }
 }
 
-static void expr_to_asm(const Expr* expr) {
-    switch (expr->type) {
-    case EXPR_IDENT: {
-        EXIT();
+static Asm* asm_binary_alloc(AsmType type, AsmArg arg0, AsmArg arg1) {
+    Asm* asm = asm_alloc();
+    asm->args[0] = arg0;
+    asm->args[1] = arg1;
+    asm->type = type;
+    return asm;
+}
+
+static void asm_label_alloc(AsmType type, const char* label) {
+    Asm* asm = asm_alloc();
+    asm->args[0] = (AsmArg){
+        .value = {.as_chars = label},
+        .type = ASM_ARG_LABEL,
+    };
+    asm->type = type;
+}
+
+static Bool i64_fits_i32(i64 value) {
+    return (-2147483648 <= value) && (value <= 2147483647);
+}
+
+static AsmArg value_vreg(u32 value) {
+    return (AsmArg){
+        .value = {.as_vreg = VREGS[value]},
+        .type = ASM_ARG_VREG,
+    };
+}
+
+// NOTE: An immediate for a constant that fits one, and otherwise the
+// register the value is in.
+static AsmArg value_to_asm_arg(u32 value) {
+    const IrValue* ir = &IR_VALUES[value];
+    if (ir->op != IR_CONST) {
+        return value_vreg(value);
     }
-    case EXPR_I64: {
-        EXIT();
+    if (i64_fits_i32(ir->imm)) {
+        return (AsmArg){.value = {.as_i32 = (i32)ir->imm},
+                        .type = ASM_ARG_I32};
     }
-    case EXPR_RET: {
-        Asm* asm = asm_alloc();
-        asm->type = ASM_RET;
-        break;
+    // NOTE: Nothing but `mov` takes a 64-bit immediate.
+    const AsmArg reg = vreg_alloc();
+    asm_binary_alloc(ASM_MOV,
+                     reg,
+                     (AsmArg){.value = {.as_i64 = ir->imm},
+                              .type = ASM_ARG_I64});
+    return reg;
+}
+
+static AsmArg value_to_asm_reg(u32 value) {
+    AsmArg arg = value_to_asm_arg(value);
+    if (arg.type == ASM_ARG_I32) {
+        const AsmArg reg = vreg_alloc();
+        asm_binary_alloc(ASM_MOV, reg, arg);
+        arg = reg;
     }
-    case EXPR_LABEL: {
-        Asm* asm = asm_alloc();
-        asm->args[0] = (AsmArg){
-            .value = {.as_chars = expr->values[0].as_chars},
-            .type = ASM_ARG_LABEL,
-        };
-        asm->type = ASM_LABEL;
-        break;
+    return arg;
+}
+
+// NOTE: A comparison read only by the branch ending its block, or by a
+// select in it, is left to that reader, which goes on the flags rather than
+// materialising them.
+static Bool value_is_fused(u32 value) {
+    const IrValue* ir = &IR_VALUES[value];
+    const IrBlock* block = &IR_BLOCKS[ir->block];
+    if (((ir->op != IR_LT) && (ir->op != IR_EQ)) || (USES[value] != 1)) {
+        return FALSE;
     }
-    case EXPR_LOAD: {
-        EXIT();
+    if ((block->term == IR_JZ) && (block->cond == value)) {
+        return TRUE;
     }
-    case EXPR_STORE: {
-        const char* label = expr->values[0].as_chars;
-        const Expr* child = expr->values[1].as_expr;
-
-        if (child->type == EXPR_ADD) {
-            const Expr* grandchild = child->values[0].as_expr;
-            if ((grandchild->type == EXPR_LOAD) &&
-                eq(label, grandchild->values[0].as_chars))
-            {
-                Asm* asm = asm_alloc();
-                expr_to_asm_arg(child->values[0].as_expr, &asm->args[0]);
-                expr_to_asm_arg(child->values[1].as_expr, &asm->args[1]);
-                asm->type = ASM_ADD;
-                break;
-            }
+    for (u32 i = 0; i < block->len_values; ++i) {
+        const IrValue* other = &IR_VALUES[block->values[i]];
+        if ((other->op == IR_SELECT) && (other->args[0] == value)) {
+            return TRUE;
         }
-        EXIT();
     }
-    case EXPR_JMP: {
-        Asm* asm = asm_alloc();
-        asm->args[0] = (AsmArg){
-            .value = {.as_chars = expr->values[0].as_chars},
-            .type = ASM_ARG_LABEL,
-        };
-        asm->type = ASM_JMP;
-        break;
+    return FALSE;
+}
+
+// NOTE: Sets the flags from `cond`, by the comparison itself when it is
+// fused and otherwise by testing it against zero, and returns the jump that
+// is taken when it is non-zero.
+static AsmType cond_to_asm(u32 cond) {
+    const IrValue* ir = &IR_VALUES[cond];
+    if (!value_is_fused(cond)) {
+        asm_binary_alloc(ASM_TEST, value_vreg(cond), value_vreg(cond));
+        return ASM_JNZ;
     }
-    case EXPR_JZ: {
-        const Expr* child = expr->values[1].as_expr;
-        switch (child->type) {
-        case EXPR_LT: {
-            {
-                Asm* asm = asm_alloc();
-                expr_to_asm_arg(child->values[0].as_expr, &asm->args[0]);
-                expr_to_asm_arg(child->values[1].as_expr, &asm->args[1]);
-                asm->type = ASM_CMP;
-            }
-            {
-                Asm* asm = asm_alloc();
-                asm->args[0] = (AsmArg){
-                    .value = {.as_chars = expr->values[0].as_chars},
-                    .type = ASM_ARG_LABEL,
-                };
-                asm->type = ASM_JGE;
-            }
-            break;
-        }
-        case EXPR_EQ: {
-            const Expr* grandchild = child->values[1].as_expr;
-            if ((grandchild->type == EXPR_I64) &&
-                (grandchild->values[0].as_i64) == 0)
-            {
-                {
-                    AsmArg arg = {0};
-                    expr_to_asm_arg(child->values[0].as_expr, &arg);
+    const AsmArg left = value_to_asm_reg(ir->args[0]);
+    const AsmArg right = value_to_asm_arg(ir->args[1]);
+    if ((right.type == ASM_ARG_I32) && (right.value.as_i32 == 0)) {
+        asm_binary_alloc(ASM_TEST, left, left);
+    } else {
+        asm_binary_alloc(ASM_CMP, left, right);
+    }
+    return ir->op == IR_LT ? ASM_JL : ASM_JZ;
+}
 
-                    Asm* asm = asm_alloc();
-                    asm->args[0] = arg;
-                    asm->args[1] = arg;
-                    asm->type = ASM_TEST;
-                }
-                {
-                    Asm* asm = asm_alloc();
-                    asm->args[0] = (AsmArg){
-                        .value = {.as_chars = expr->values[0].as_chars},
-                        .type = ASM_ARG_LABEL,
-                    };
-                    asm->type = ASM_JNZ;
-                }
-                break;
-            }
-            EXIT();
-        }
-        case EXPR_IDENT:
-        case EXPR_I64:
-        case EXPR_RET:
-        case EXPR_LABEL:
-        case EXPR_LOAD:
-        case EXPR_STORE:
-        case EXPR_JMP:
-        case EXPR_JZ:
-        case EXPR_AND:
-        case EXPR_ADD:
-        default: {
-            EXIT();
-        }
+static const AsmType VALUE_ASMS[] = {
+    [IR_AND] = ASM_AND,
+    [IR_ADD] = ASM_ADD,
+    [IR_SUB] = ASM_SUB,
+    [IR_MUL] = ASM_IMUL,
+    [IR_SHR] = ASM_SHR,
+};
+
+// NOTE: Every operator writes a register of its own, which starts as a copy
+// of its left operand; `asms_coalesce` drops the copy whenever it can.
+static void value_to_asm(u32 value) {
+    const IrValue* ir = &IR_VALUES[value];
+    const AsmArg   dst = value_vreg(value);
+    switch (ir->op) {
+    case IR_LT:
+    case IR_EQ: {
+        if (value_is_fused(value)) {
+            break;
         }
+        const AsmArg left = value_to_asm_reg(ir->args[0]);
+        const AsmArg right = value_to_asm_arg(ir->args[1]);
+        asm_binary_alloc(ASM_CMP, left, right);
+        asm_binary_alloc(ir->op == IR_LT ? ASM_SETL : ASM_SETE,
+                         dst,
+                         (AsmArg){0});
         break;
     }
-    case EXPR_LT: {
-        EXIT();
-    }
-    case EXPR_EQ: {
-        EXIT();
+    case IR_AND:
+    case IR_ADD:
+    case IR_MUL: {
+        u32 left = ir->args[0];
+        u32 right = ir->args[1];
+        if ((IR_VALUES[left].op == IR_CONST) &&
+            (IR_VALUES[right].op != IR_CONST))
+        {
+            left = ir->args[1];
+            right = ir->args[0];
+        }
+        asm_binary_alloc(ASM_MOV, dst, value_to_asm_arg(left));
+        asm_binary_alloc(VALUE_ASMS[ir->op], dst, value_to_asm_arg(right));
+        break;
     }
-    case EXPR_AND: {
-        EXIT();
+    case IR_SUB:
+    case IR_SHR: {
+        EXIT_IF((ir->op == IR_SHR) &&
+                (IR_VALUES[ir->args[1]].op != IR_CONST));
+        asm_binary_alloc(ASM_MOV, dst, value_to_asm_arg(ir->args[0]));
+        asm_binary_alloc(VALUE_ASMS[ir->op],
+                         dst,
+                         value_to_asm_arg(ir->args[1]));
+        break;
     }
-    case EXPR_ADD: {
-        EXIT();
+    case IR_SELECT: {
+        asm_binary_alloc(ASM_MOV, dst, value_to_asm_arg(ir->args[2]));
+        const AsmArg  src = value_to_asm_reg(ir->args[1]);
+        const AsmType jump = cond_to_asm(ir->args[0]);
+        asm_binary_alloc(jump == ASM_JL   ? ASM_CMOVL
+                         : jump == ASM_JZ ? ASM_CMOVZ
+                                          : ASM_CMOVNZ,
+                         dst,
+                         src);
+        break;
     }
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_PHI:
     default: {
-        EXIT();
+        break;
     }
     }
 }
 
-static void asm_to_bytes(Asm* asm) {
-    switch (asm->type) {
-    case ASM_NOP: {
-        EXIT();
-    }
-    case ASM_RET: {
-        byte_push(0xC3);
-        break;
+static Bool block_has_phis(u32 block) {
+    const IrBlock* ir = &IR_BLOCKS[block];
+    return (ir->len_values != 0) && (IR_VALUES[ir->values[0]].op == IR_PHI);
+}
+
+// NOTE: A block with nothing in it but a jump to one without phis is never
+// emitted; whatever goes there goes straight on to where it jumps.
+static Bool block_is_empty(u32 block) {
+    const IrBlock* ir = &IR_BLOCKS[block];
+    return (block != 0) && (ir->len_values == 0) && (ir->term == IR_JMP) &&
+           !block_has_phis(ir->succs[0]);
+}
+
+static u32 block_target(u32 block) {
+    for (u32 i = 0; (i < LEN_IR_BLOCKS) && block_is_empty(block); ++i) {
+        block = IR_BLOCKS[block].succs[0];
     }
-    case ASM_LABEL: {
-        asm_label_push(asm->args[0].value.as_chars);
-        break;
+    return block;
+}
+
+// NOTE: Copies into the phis of `to` what they take along the edge from
+// `from`. The copies happen all at once, so one whose destination another
+// still reads waits for it, and a cycle is broken through a fresh register.
+static void block_to_asm_phis(u32 from, u32 to) {
+    const IrBlock* block = &IR_BLOCKS[to];
+    u32            j = 0;
+    while (block->preds[j] != from) {
+        ++j;
     }
-    case ASM_MOV: {
-        const AsmArg arg0 = asm->args[0];
-        const AsmArg arg1 = asm->args[1];
-        if (((arg0.type == ASM_ARG_REG) && (arg1.type == ASM_ARG_ADDR)) &&
-            (arg0.value.as_reg == ASM_REG_R8) &&
-            (arg1.value.as_addr.reg == ASM_REG_RDI) &&
-            (arg1.value.as_addr.offset == 0))
-        {
-            byte_push(0x4C);
-            byte_push(0x8B);
-            byte_push(0x07);
+
+    AsmArg* dsts = ARENA_ALLOC(&ARENA_ASM, AsmArg, block->len_values);
+    AsmArg* srcs = ARENA_ALLOC(&ARENA_ASM, AsmArg, block->len_values);
+    u32     len = 0;
+    for (u32 i = 0; i < block->len_values; ++i) {
+        const u32 phi = block->values[i];
+        if (IR_VALUES[phi].op != IR_PHI) {
             break;
         }
-        EXIT();
+        const u32 arg = IR_VALUES[phi].args[j];
+        if ((IR_VALUES[arg].op == IR_CONST) || (VREGS[arg] != VREGS[phi])) {
+            dsts[len] = value_vreg(phi);
+            srcs[len] = value_to_asm_arg(arg);
+            ++len;
+        }
     }
-    case ASM_JMP: {
-        byte_push(0xE9);
-        LEN_BYTES += sizeof(i32);
-        patch_push(asm->args[0].value.as_chars);
-        break;
+
+    while (len != 0) {
+        u32 ready = len;
+        for (u32 i = 0; (i < len) && (ready == len); ++i) {
+            ready = i;
+            for (u32 k = 0; k < len; ++k) {
+                if ((k != i) && (srcs[k].type == ASM_ARG_VREG) &&
+                    (srcs[k].value.as_vreg == dsts[i].value.as_vreg))
+                {
+                    ready = len;
+                    break;
+                }
+            }
+        }
+        if (ready == len) {
+            const AsmArg reg = vreg_alloc();
+            asm_binary_alloc(ASM_MOV, reg, dsts[0]);
+            for (u32 k = 0; k < len; ++k) {
+                if ((srcs[k].type == ASM_ARG_VREG) &&
+                    (srcs[k].value.as_vreg == dsts[0].value.as_vreg))
+                {
+                    srcs[k] = reg;
+                }
+            }
+            continue;
+        }
+        asm_binary_alloc(ASM_MOV, dsts[ready], srcs[ready]);
+        --len;
+        dsts[ready] = dsts[len];
+        srcs[ready] = srcs[len];
     }
-    case ASM_JNZ: {
-        byte_push(0x0F);
-        byte_push(0x85);
-        LEN_BYTES += sizeof(i32);
-        patch_push(asm->args[0].value.as_chars);
-        break;
+}
+
+// NOTE: Branches to `label` when `cond` is zero, or, with `nonzero`, when it
+// is not.
+static void block_to_asm_jz(const IrBlock* block,
+                            const char*    label,
+                            Bool           nonzero) {
+    const u32      cond = block->cond;
+    const IrValue* ir = &IR_VALUES[cond];
+    if (ir->op == IR_CONST) {
+        if ((ir->imm == 0) != nonzero) {
+            asm_label_alloc(ASM_JMP, label);
+        }
+        return;
     }
-    case ASM_JGE: {
-        byte_push(0x0F);
-        byte_push(0x8D);
-        LEN_BYTES += sizeof(i32);
-        patch_push(asm->args[0].value.as_chars);
-        break;
+    const AsmType jump = cond_to_asm(cond);
+    if (nonzero) {
+        asm_label_alloc(jump, label);
+    } else {
+        asm_label_alloc(jump == ASM_JL   ? ASM_JGE
+                        : jump == ASM_JZ ? ASM_JNZ
+                                         : ASM_JZ,
+                        label);
     }
-    case ASM_TEST: {
-        const AsmArg arg0 = asm->args[0];
-        const AsmArg arg1 = asm->args[1];
-        if (((arg0.type & arg1.type) == ASM_ARG_REG) &&
-            (arg0.value.as_reg == ASM_REG_R8) &&
-            (arg1.value.as_reg == ASM_REG_R8))
-        {
-            byte_push(0x4D);
-            byte_push(0x85);
-            byte_push(0xC0);
-            break;
+}
+
+// NOTE: Writes back every local that no longer holds its entry value, then
+// leaves the instruction to resume at in `rax`; only after the stores, as a
+// spilled one goes through `rax`.
+static void block_to_asm_exit(const IrBlock* block) {
+    for (u32 i = 0; i < LEN_ESCAPES; ++i) {
+        const u32      out = block->outs[i];
+        const IrValue* ir = &IR_VALUES[out];
+        if ((ir->op == IR_PARAM) && (ir->local == i)) {
+            continue;
         }
-        EXIT();
+        asm_binary_alloc(
+            ASM_MOV,
+            (AsmArg){
+                .value = {.as_addr = {.base = ASM_REG_RDI,
+                                      .offset = (i32)(ESCAPES[i] *
+                                                      sizeof(i64))}},
+                .type = ASM_ARG_ADDR,
+            },
+            value_to_asm_arg(out));
     }
-    case ASM_CMP: {
-        const AsmArg arg0 = asm->args[0];
-        const AsmArg arg1 = asm->args[1];
-        if (((arg0.type == ASM_ARG_ADDR) && (arg1.type == ASM_ARG_I32)) &&
-            (arg0.value.as_addr.reg == ASM_REG_RDI) &&
-            arg0.value.as_addr.offset == 0)
-        {
-            byte_push(0x48);
-            byte_push(0x81);
-            byte_push(0x3F);
-            memcpy(&BYTES[LEN_BYTES], &arg1.value.as_i32, sizeof(i32));
-            LEN_BYTES += sizeof(i32);
-            break;
-        }
-        EXIT();
+    asm_binary_alloc(
+        ASM_MOV,
+        (AsmArg){.value = {.as_reg = ASM_REG_RAX}, .type = ASM_ARG_REG},
+        (AsmArg){.value = {.as_i32 = (i32)block->exit}, .type = ASM_ARG_I32});
+    Asm* asm = asm_alloc();
+    asm->type = ASM_RET;
+}
+
+static u32 block_to_asm(u32 block, u32 next) {
+    const IrBlock* ir = &IR_BLOCKS[block];
+    if (block != 0) {
+        asm_label_alloc(ASM_LABEL, LABELS[block]);
     }
-    case ASM_AND: {
-        const AsmArg arg0 = asm->args[0];
-        const AsmArg arg1 = asm->args[1];
-        if (((arg0.type == ASM_ARG_REG) && (arg1.type == ASM_ARG_I32)) &&
-            (arg0.value.as_reg == ASM_REG_R8))
-        {
-            byte_push(0x49);
-            byte_push(0x81);
-            byte_push(0xE0);
-            memcpy(&BYTES[LEN_BYTES], &arg1.value.as_i32, sizeof(i32));
-            LEN_BYTES += sizeof(i32);
-            break;
+    for (u32 i = 0; i < ir->len_values; ++i) {
+        value_to_asm(ir->values[i]);
+    }
+    switch (ir->term) {
+    case IR_JMP: {
+        if (block_has_phis(ir->succs[0])) {
+            block_to_asm_phis(block, ir->succs[0]);
         }
-        EXIT();
+        const u32 target = block_target(ir->succs[0]);
+        if (target != next) {
+            asm_label_alloc(ASM_JMP, LABELS[target]);
+        }
+        return OK;
     }
-    case ASM_ADD: {
-        const AsmArg arg0 = asm->args[0];
-        const AsmArg arg1 = asm->args[1];
-        if (((arg0.type == ASM_ARG_ADDR) && (arg1.type == ASM_ARG_I32)) &&
-            (arg0.value.as_addr.reg == ASM_REG_RDI) &&
-            (arg0.value.as_addr.offset == 0))
-        {
-            byte_push(0x48);
-            byte_push(0x81);
-            byte_push(0x07);
-            memcpy(&BYTES[LEN_BYTES], &arg1.value.as_i32, sizeof(i32));
-            LEN_BYTES += sizeof(i32);
-            break;
+    case IR_JZ: {
+        if (block_has_phis(ir->succs[0]) || block_has_phis(ir->succs[1])) {
+            return ERROR;
         }
-        EXIT();
+        // NOTE: Whichever successor comes next is reached by falling through,
+        // so the branch is inverted when that is the zero side.
+        const u32 target = block_target(ir->succs[0]);
+        const u32 zero = block_target(ir->succs[1]);
+        if (zero == next) {
+            block_to_asm_jz(ir, LABELS[target], TRUE);
+            return OK;
+        }
+        block_to_asm_jz(ir, LABELS[zero], FALSE);
+        if (target != next) {
+            asm_label_alloc(ASM_JMP, LABELS[target]);
+        }
+        return OK;
+    }
+    case IR_EXIT: {
+        block_to_asm_exit(ir);
+        return OK;
     }
     default: {
         EXIT();
@@ -552,60 +773,1295 @@ static void asm_to_bytes(Asm* asm) {
     }
 }
 
-void asm_emit(void) {
-    LEN_ASMS = 0;
-    LEN_REGS = 0;
-    LEN_PTRS = 0;
-    LEN_BYTES = 0;
-    LEN_ASM_LABELS = 0;
-    LEN_PATCHES = 0;
-
-    for (u32 i = 0; i < LEN_ESCAPES; ++i) {
-        KeyValue* pointer = ptr_alloc();
-        pointer->key = ESCAPES[i];
-        pointer->value.as_reg = reg_alloc();
-    }
-
-    const u32 len_regs = LEN_REGS;
-    for (u32 i = LEN_LIST; i != 0;) {
-        LEN_REGS = len_regs;
-        expr_to_asm(LIST[--i]);
+// NOTE: The successor of `block` to lay out next: the one that ran most of
+// those not yet placed, leaving out any that never ran unless `cold`.
+// `LEN_IR_BLOCKS` if there is none.
+static u32 block_next(u32 block, const Bool* placed, Bool cold) {
+    const IrBlock* ir = &IR_BLOCKS[block];
+    u32            next = LEN_IR_BLOCKS;
+    for (u32 i = 0; i < ir_len_succs(ir); ++i) {
+        const u32 target = block_target(ir->succs[i]);
+        if (placed[target] || (!cold && (IR_BLOCKS[target].runs == 0))) {
+            continue;
+        }
+        if ((next == LEN_IR_BLOCKS) ||
+            (IR_BLOCKS[next].runs < IR_BLOCKS[target].runs))
+        {
+            next = target;
+        }
     }
+    return next;
+}
 
-    for (u32 i = 0; i < LEN_ASMS; ++i) {
-        asm_to_bytes(&ASMS[i]);
+// NOTE: Lays the blocks out in chains, each block followed by its hottest
+// successor not yet placed, so the common way out of a branch falls through
+// and only the rare one jumps. Blocks the interpreter never ran go after
+// all the others, out of the way of the hot ones; ties keep program order.
+// The entry block comes first, as the prologue falls into it.
+static u32 blocks_layout(u32* layout) {
+    Bool* placed = ARENA_ALLOC(&ARENA_ASM, Bool, LEN_IR_BLOCKS);
+    u32   len_layout = 0;
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        placed[i] = !IR_BLOCKS[i].reachable || block_is_empty(i);
     }
-
-    for (u32 i = 0; i < LEN_PATCHES; ++i) {
-        for (u32 j = 0; j < LEN_ASM_LABELS; ++j) {
-            if (!eq(PATCHES[i].key, ASM_LABELS[j].key)) {
+    for (u32 pass = 0; pass < 2; ++pass) {
+        const Bool cold = pass != 0;
+        for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+            if (placed[i] || (!cold && (i != 0) && (IR_BLOCKS[i].runs == 0)))
+            {
                 continue;
             }
+            for (u32 b = i; b != LEN_IR_BLOCKS; b = block_next(b, placed, cold))
+            {
+                placed[b] = TRUE;
+                layout[len_layout++] = b;
+            }
+        }
+    }
+    return len_layout;
+}
 
-            const i64 offset =
-                ASM_LABELS[j].value.as_bytes - PATCHES[i].value.as_bytes;
-            EXIT_IF(2147483647 < offset);
-            EXIT_IF(offset < -2147483648);
+static void i32_push(i32 value) {
+    memcpy(&BYTES[LEN_BYTES], &value, sizeof(i32));
+    LEN_BYTES += sizeof(i32);
+}
+
+static void i64_push(i64 value) {
+    memcpy(&BYTES[LEN_BYTES], &value, sizeof(i64));
+    LEN_BYTES += sizeof(i64);
+}
+
+static Bool fits_i8(i64 value) {
+    return (-128 <= value) && (value <= 127);
+}
+
+// NOTE: `reg`, `index`, and `base` are the full 4-bit register numbers; only
+// their high bits land here.
+static u8 rex(Bool w, u8 reg, u8 index, u8 base) {
+    return (u8)(0x40 | (w ? 0x08 : 0) | ((reg >> 3) << 2) |
+                ((index >> 3) << 1) | (base >> 3));
+}
+
+static u8 modrm(u8 mod, u8 reg, u8 rm) {
+    return (u8)((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+}
+
+static u8 scale_bits(u8 scale) {
+    switch (scale) {
+    case 1: {
+        return 0;
+    }
+    case 2: {
+        return 1;
+    }
+    case 4: {
+        return 2;
+    }
+    case 8: {
+        return 3;
+    }
+    default: {
+        EXIT();
+    }
+    }
+}
+
+static u32 addr_validate(AsmArgAddr addr) {
+    if (addr.scale == 0) {
+        return OK;
+    }
+    if ((addr.index == ASM_REG_RSP) ||
+        ((addr.scale != 1) && (addr.scale != 2) && (addr.scale != 4) &&
+         (addr.scale != 8)))
+    {
+        return ERROR;
+    }
+    return OK;
+}
+
+// NOTE: `rsp` and `r12` as a base need a SIB byte, and `rbp` and `r13` as a
+// base have no displacement-free form, so they take a zero `disp8`.
+static void modrm_addr_push(u8 reg, AsmArgAddr addr) {
+    const u8   base = (u8)addr.base;
+    const Bool sib = (addr.scale != 0) || ((base & 7) == ASM_REG_RSP);
+
+    u8 mod = 2;
+    if ((addr.offset == 0) && ((base & 7) != ASM_REG_RBP)) {
+        mod = 0;
+    } else if (fits_i8(addr.offset)) {
+        mod = 1;
+    }
+
+    byte_push(modrm(mod, reg, sib ? ASM_REG_RSP : base));
+    if (sib) {
+        const u8 index = addr.scale == 0 ? ASM_REG_RSP : (u8)addr.index;
+        const u8 scale = addr.scale == 0 ? 0 : scale_bits(addr.scale);
+        byte_push((u8)((scale << 6) | ((index & 7) << 3) | (base & 7)));
+    }
+    if (mod == 1) {
+        byte_push((u8)(addr.offset & 0xFF));
+    } else if (mod == 2) {
+        i32_push(addr.offset);
+    }
+}
+
+static void rex_addr_push(Bool w, u8 reg, AsmArgAddr addr) {
+    const u8 index = addr.scale == 0 ? 0 : (u8)addr.index;
+    const u8 prefix = rex(w, reg, index, (u8)addr.base);
+    if (prefix != 0x40) {
+        byte_push(prefix);
+    }
+}
+
+// NOTE: Opcodes for one instruction across its operand shapes. `op_mr` stores
+// a register into `r/m`, `op_rm` loads `r/m` into a register, and `op_imm`
+// and `op_imm8` take a sign-extended immediate with `ext` in the reg field;
+// a zero opcode means there is no such form. Branches and `setcc` only use
+// `cc`, their condition code.
+typedef struct {
+    u8 op_mr;
+    u8 op_rm;
+    u8 op_imm;
+    u8 op_imm8;
+    u8 ext;
+    u8 cc;
+} AsmEncoding;
+
+static const AsmEncoding ENCODINGS[] = {
+    [ASM_MOV] = {.op_mr = 0x89, .op_rm = 0x8B, .op_imm = 0xC7, .ext = 0},
+    [ASM_JZ] = {.cc = 0x4},
+    [ASM_JNZ] = {.cc = 0x5},
+    [ASM_JGE] = {.cc = 0xD},
+    [ASM_JL] = {.cc = 0xC},
+    [ASM_TEST] = {.op_mr = 0x85, .op_rm = 0x85, .op_imm = 0xF7, .ext = 0},
+    [ASM_CMP] = {.op_mr = 0x39,
+                 .op_rm = 0x3B,
+                 .op_imm = 0x81,
+                 .op_imm8 = 0x83,
+                 .ext = 7},
+    [ASM_SETL] = {.cc = 0xC},
+    [ASM_SETE] = {.cc = 0x4},
+    [ASM_CMOVL] = {.cc = 0xC},
+    [ASM_CMOVZ] = {.cc = 0x4},
+    [ASM_CMOVNZ] = {.cc = 0x5},
+    [ASM_AND] = {.op_mr = 0x21,
+                 .op_rm = 0x23,
+                 .op_imm = 0x81,
+                 .op_imm8 = 0x83,
+                 .ext = 4},
+    [ASM_ADD] = {.op_mr = 0x01,
+                 .op_rm = 0x03,
+                 .op_imm = 0x81,
+                 .op_imm8 = 0x83,
+                 .ext = 0},
+    [ASM_SUB] = {.op_mr = 0x29,
+                 .op_rm = 0x2B,
+                 .op_imm = 0x81,
+                 .op_imm8 = 0x83,
+                 .ext = 5},
+};
+
+static void imm_push(AsmEncoding encoding, i32 value) {
+    if ((encoding.op_imm8 != 0) && fits_i8(value)) {
+        byte_push((u8)(value & 0xFF));
+    } else {
+        i32_push(value);
+    }
+}
+
+static u8 op_imm(AsmEncoding encoding, i32 value) {
+    return (encoding.op_imm8 != 0) && fits_i8(value) ? encoding.op_imm8
+                                                      : encoding.op_imm;
+}
+
+// NOTE: Every 64-bit two-operand instruction, for any pair of operands x86-64
+// can encode.
+static u32 alu_to_bytes(const Asm* asm) {
+    const AsmEncoding encoding = ENCODINGS[asm->type];
+    const AsmArg      arg0 = asm->args[0];
+    const AsmArg      arg1 = asm->args[1];
+
+    if (arg0.type == ASM_ARG_REG) {
+        const u8 dst = (u8)arg0.value.as_reg;
+        switch (arg1.type) {
+        case ASM_ARG_REG: {
+            const u8 src = (u8)arg1.value.as_reg;
+            byte_push(rex(TRUE, src, 0, dst));
+            byte_push(encoding.op_mr);
+            byte_push(modrm(3, src, dst));
+            return OK;
+        }
+        case ASM_ARG_ADDR: {
+            if (addr_validate(arg1.value.as_addr) != OK) {
+                return ERROR;
+            }
+            rex_addr_push(TRUE, dst, arg1.value.as_addr);
+            byte_push(encoding.op_rm);
+            modrm_addr_push(dst, arg1.value.as_addr);
+            return OK;
+        }
+        case ASM_ARG_I32: {
+            const i32 value = arg1.value.as_i32;
+            if ((asm->type == ASM_MOV) && (0 <= value)) {
+                // NOTE: A 32-bit `mov` zero-extends, so a non-negative
+                // immediate needs neither `REX.W` nor a ModRM byte.
+                if (7 < dst) {
+                    byte_push(rex(FALSE, 0, 0, dst));
+                }
+                byte_push((u8)(0xB8 | (dst & 7)));
+                i32_push(value);
+                return OK;
+            }
+            byte_push(rex(TRUE, 0, 0, dst));
+            byte_push(op_imm(encoding, value));
+            byte_push(modrm(3, encoding.ext, dst));
+            imm_push(encoding, value);
+            return OK;
+        }
+        case ASM_ARG_I64: {
+            if (asm->type != ASM_MOV) {
+                return ERROR;
+            }
+            byte_push(rex(TRUE, 0, 0, dst));
+            byte_push((u8)(0xB8 | (dst & 7)));
+            i64_push(arg1.value.as_i64);
+            return OK;
+        }
+        case ASM_ARG_NONE:
+        case ASM_ARG_LABEL:
+        case ASM_ARG_VREG:
+        default: {
+            return ERROR;
+        }
+        }
+    }
 
+    if (arg0.type == ASM_ARG_ADDR) {
+        const AsmArgAddr addr = arg0.value.as_addr;
+        if (addr_validate(addr) != OK) {
+            return ERROR;
+        }
+        switch (arg1.type) {
+        case ASM_ARG_REG: {
+            const u8 src = (u8)arg1.value.as_reg;
+            rex_addr_push(TRUE, src, addr);
+            byte_push(encoding.op_mr);
+            modrm_addr_push(src, addr);
+            return OK;
+        }
+        case ASM_ARG_I32: {
+            const i32 value = arg1.value.as_i32;
+            rex_addr_push(TRUE, 0, addr);
+            byte_push(op_imm(encoding, value));
+            modrm_addr_push(encoding.ext, addr);
+            imm_push(encoding, value);
+            return OK;
+        }
+        case ASM_ARG_NONE:
+        case ASM_ARG_LABEL:
+        case ASM_ARG_ADDR:
+        case ASM_ARG_I64:
+        case ASM_ARG_VREG:
+        default: {
+            return ERROR;
+        }
+        }
+    }
+
+    return ERROR;
+}
+
+// NOTE: A two-byte opcode, `0F op`, writing register `dst` from a register
+// or memory operand.
+static u32 rm_to_bytes(u8 op, u8 dst, AsmArg src) {
+    switch (src.type) {
+    case ASM_ARG_REG: {
+        const u8 reg = (u8)src.value.as_reg;
+        byte_push(rex(TRUE, dst, 0, reg));
+        byte_push(0x0F);
+        byte_push(op);
+        byte_push(modrm(3, dst, reg));
+        return OK;
+    }
+    case ASM_ARG_ADDR: {
+        if (addr_validate(src.value.as_addr) != OK) {
+            return ERROR;
+        }
+        rex_addr_push(TRUE, dst, src.value.as_addr);
+        byte_push(0x0F);
+        byte_push(op);
+        modrm_addr_push(dst, src.value.as_addr);
+        return OK;
+    }
+    case ASM_ARG_NONE:
+    case ASM_ARG_LABEL:
+    case ASM_ARG_I32:
+    case ASM_ARG_I64:
+    case ASM_ARG_VREG:
+    default: {
+        return ERROR;
+    }
+    }
+}
+
+// NOTE: `imul` only ever writes a register. With an immediate it is the
+// three-operand form, here multiplying the register by itself.
+static u32 imul_to_bytes(const Asm* asm) {
+    const AsmArg arg0 = asm->args[0];
+    const AsmArg arg1 = asm->args[1];
+    if (arg0.type != ASM_ARG_REG) {
+        return ERROR;
+    }
+    const u8 dst = (u8)arg0.value.as_reg;
+    switch (arg1.type) {
+    case ASM_ARG_REG:
+    case ASM_ARG_ADDR: {
+        return rm_to_bytes(0xAF, dst, arg1);
+    }
+    case ASM_ARG_I32: {
+        const i32 value = arg1.value.as_i32;
+        byte_push(rex(TRUE, dst, 0, dst));
+        byte_push(fits_i8(value) ? 0x6B : 0x69);
+        byte_push(modrm(3, dst, dst));
+        if (fits_i8(value)) {
+            byte_push((u8)(value & 0xFF));
+        } else {
+            i32_push(value);
+        }
+        return OK;
+    }
+    case ASM_ARG_NONE:
+    case ASM_ARG_LABEL:
+    case ASM_ARG_I64:
+    case ASM_ARG_VREG:
+    default: {
+        return ERROR;
+    }
+    }
+}
+
+// NOTE: `cmov` only ever writes a register, and only from another or from
+// memory.
+static u32 cmov_to_bytes(const Asm* asm) {
+    if (asm->args[0].type != ASM_ARG_REG) {
+        return ERROR;
+    }
+    return rm_to_bytes((u8)(0x40 | ENCODINGS[asm->type].cc),
+                       (u8)asm->args[0].value.as_reg,
+                       asm->args[1]);
+}
+
+// NOTE: A shift by an immediate, which is all there ever is.
+static u32 shr_to_bytes(const Asm* asm) {
+    const AsmArg arg0 = asm->args[0];
+    const AsmArg arg1 = asm->args[1];
+    if ((arg1.type != ASM_ARG_I32) || (arg1.value.as_i32 < 0) ||
+        (63 < arg1.value.as_i32))
+    {
+        return ERROR;
+    }
+    if (arg0.type == ASM_ARG_REG) {
+        const u8 dst = (u8)arg0.value.as_reg;
+        byte_push(rex(TRUE, 0, 0, dst));
+        byte_push(0xC1);
+        byte_push(modrm(3, 5, dst));
+    } else if (arg0.type == ASM_ARG_ADDR) {
+        if (addr_validate(arg0.value.as_addr) != OK) {
+            return ERROR;
+        }
+        rex_addr_push(TRUE, 0, arg0.value.as_addr);
+        byte_push(0xC1);
+        modrm_addr_push(5, arg0.value.as_addr);
+    } else {
+        return ERROR;
+    }
+    byte_push((u8)arg1.value.as_i32);
+    return OK;
+}
+
+// NOTE: `setcc` writes only the low byte, so it is followed by a `movzx` of
+// that byte into the whole register. The empty `REX` keeps `sil` and `dil`
+// from encoding as `dh` and `bh`.
+static u32 setcc_to_bytes(const Asm* asm) {
+    const AsmArg arg = asm->args[0];
+    if (arg.type != ASM_ARG_REG) {
+        return ERROR;
+    }
+    const u8 reg = (u8)arg.value.as_reg;
+    byte_push(rex(FALSE, 0, 0, reg));
+    byte_push(0x0F);
+    byte_push((u8)(0x90 | ENCODINGS[asm->type].cc));
+    byte_push(modrm(3, 0, reg));
+
+    byte_push(rex(TRUE, reg, 0, reg));
+    byte_push(0x0F);
+    byte_push(0xB6);
+    byte_push(modrm(3, reg, reg));
+    return OK;
+}
+
+// NOTE: `push` and `pop` carry the register in the opcode itself.
+static u32 stack_to_bytes(const Asm* asm, u8 op) {
+    const AsmArg arg = asm->args[0];
+    if (arg.type != ASM_ARG_REG) {
+        return ERROR;
+    }
+    const u8 reg = (u8)arg.value.as_reg;
+    if (7 < reg) {
+        byte_push(rex(FALSE, 0, 0, reg));
+    }
+    byte_push((u8)(op | (reg & 7)));
+    return OK;
+}
+
+// NOTE: Emits the opcode and leaves room for the displacement, which is
+// filled in once every offset is final.
+static void jump_to_bytes(u32 i) {
+    const Asm* asm = &ASMS[i];
+    if (asm->type == ASM_JMP) {
+        byte_push(FAR[i] ? 0xE9 : 0xEB);
+    } else if (FAR[i]) {
+        byte_push(0x0F);
+        byte_push((u8)(0x80 | ENCODINGS[asm->type].cc));
+    } else {
+        byte_push((u8)(0x70 | ENCODINGS[asm->type].cc));
+    }
+    LEN_BYTES += FAR[i] ? sizeof(i32) : sizeof(u8);
+}
+
+static u32 asm_to_bytes(u32 i) {
+    const Asm* asm = &ASMS[i];
+    switch (asm->type) {
+    case ASM_RET: {
+        byte_push(0xC3);
+        return OK;
+    }
+    case ASM_LABEL: {
+        return OK;
+    }
+    case ASM_JMP:
+    case ASM_JZ:
+    case ASM_JNZ:
+    case ASM_JGE:
+    case ASM_JL: {
+        jump_to_bytes(i);
+        return OK;
+    }
+    case ASM_SETL:
+    case ASM_SETE: {
+        return setcc_to_bytes(asm);
+    }
+    case ASM_MOV:
+    case ASM_TEST:
+    case ASM_CMP:
+    case ASM_AND:
+    case ASM_ADD:
+    case ASM_SUB: {
+        return alu_to_bytes(asm);
+    }
+    case ASM_IMUL: {
+        return imul_to_bytes(asm);
+    }
+    case ASM_CMOVL:
+    case ASM_CMOVZ:
+    case ASM_CMOVNZ: {
+        return cmov_to_bytes(asm);
+    }
+    case ASM_SHR: {
+        return shr_to_bytes(asm);
+    }
+    case ASM_PUSH: {
+        return stack_to_bytes(asm, 0x50);
+    }
+    case ASM_POP: {
+        return stack_to_bytes(asm, 0x58);
+    }
+    case ASM_NOP:
+    default: {
+        return ERROR;
+    }
+    }
+}
+
+static Bool asm_is_jump(const Asm* asm) {
+    return (asm->type == ASM_JMP) || (asm->type == ASM_JZ) ||
+           (asm->type == ASM_JNZ) || (asm->type == ASM_JGE) ||
+           (asm->type == ASM_JL);
+}
+
+// NOTE: From the end of jump `i` to its target.
+static i64 jump_offset(u32 i) {
+    return (i64)OFFSETS[TARGETS[i]] - (i64)OFFSETS[i + 1];
+}
+
+// NOTE: Every jump starts short and is only ever lengthened, so offsets only
+// grow and relaxation settles in at most one pass per jump.
+static u32 asms_to_bytes(void) {
+    for (;;) {
+        LEN_BYTES = 0;
+        for (u32 i = 0; i < LEN_ASMS; ++i) {
+            OFFSETS[i] = LEN_BYTES;
+            if (asm_to_bytes(i) != OK) {
+                return ERROR;
+            }
+        }
+        OFFSETS[LEN_ASMS] = LEN_BYTES;
+
+        Bool relaxed = TRUE;
+        for (u32 i = 0; i < LEN_ASMS; ++i) {
+            if (asm_is_jump(&ASMS[i]) && !FAR[i] && !fits_i8(jump_offset(i))) {
+                FAR[i] = TRUE;
+                relaxed = FALSE;
+            }
+        }
+        if (relaxed) {
+            break;
+        }
+    }
+
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        if (!asm_is_jump(&ASMS[i])) {
+            continue;
+        }
+        const i64 offset = jump_offset(i);
+        if (FAR[i]) {
+            EXIT_IF(2147483647 < offset);
+            EXIT_IF(offset < -2147483648);
             const i32 truncated = (i32)offset;
-            memcpy(PATCHES[i].value.as_bytes - sizeof(i32),
+            memcpy(&BYTES[OFFSETS[i + 1] - sizeof(i32)],
                    &truncated,
                    sizeof(i32));
+        } else {
+            BYTES[OFFSETS[i + 1] - 1] = (u8)(offset & 0xFF);
         }
     }
+    return OK;
 }
 
-void* asm_jit(void) {
-    void* func = mmap(NULL,
-                      LEN_BYTES,
+// NOTE: Whether an instruction reads, and whether it writes, its first
+// operand; the second is only ever read.
+static Bool asm_reads_first(AsmType type) {
+    return (type == ASM_TEST) || (type == ASM_CMP) || (type == ASM_AND) ||
+           (type == ASM_ADD) || (type == ASM_SUB) || (type == ASM_IMUL) ||
+           (type == ASM_CMOVL) || (type == ASM_CMOVZ) ||
+           (type == ASM_CMOVNZ) || (type == ASM_SHR) || (type == ASM_PUSH);
+}
+
+static Bool asm_writes_first(AsmType type) {
+    return (type == ASM_MOV) || (type == ASM_SETL) || (type == ASM_SETE) ||
+           (type == ASM_AND) || (type == ASM_ADD) || (type == ASM_SUB) ||
+           (type == ASM_IMUL) || (type == ASM_CMOVL) || (type == ASM_CMOVZ) ||
+           (type == ASM_CMOVNZ) || (type == ASM_SHR) || (type == ASM_POP);
+}
+
+static Bool asm_falls_through(const Asm* asm) {
+    return (asm->type != ASM_JMP) && (asm->type != ASM_RET);
+}
+
+#define VREG_NONE 0xFFFFFFFF
+
+static u32 asm_def(const Asm* asm) {
+    return asm_writes_first(asm->type) && (asm->args[0].type == ASM_ARG_VREG)
+               ? asm->args[0].value.as_vreg
+               : VREG_NONE;
+}
+
+// NOTE: Indexed by `Asm`, `LEN_WORDS` words to each; the virtual registers
+// live on the way into and out of it.
+static u64* LIVE_IN = NULL;
+static u64* LIVE_OUT = NULL;
+static u32  LEN_WORDS = 0;
+
+static Bool live_has(const u64* live, u32 vreg) {
+    return ((live[vreg / 64] >> (vreg % 64)) & 1) != 0;
+}
+
+static void live_set(u64* live, u32 vreg) {
+    live[vreg / 64] |= 1lu << (vreg % 64);
+}
+
+// NOTE: Points every jump in `ASMS` at the `Asm` of its label. Every pass
+// that inserts or drops instructions moves labels, so it runs again after
+// each one.
+static u32 asms_resolve(void) {
+    table_init(&ASM_LABELS, &ARENA_ASM, 0);
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        if ((ASMS[i].type == ASM_LABEL) &&
+            !table_insert(&ASM_LABELS, ASMS[i].args[0].value.as_chars, i))
+        {
+            return ERROR;
+        }
+    }
+    TARGETS = ARENA_ALLOC(&ARENA_ASM, u32, LEN_ASMS);
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        if (!asm_is_jump(&ASMS[i])) {
+            continue;
+        }
+        const u32* label =
+            table_find(&ASM_LABELS, ASMS[i].args[0].value.as_chars);
+        if (label == NULL) {
+            return ERROR;
+        }
+        TARGETS[i] = *label;
+    }
+    return OK;
+}
+
+// NOTE: Backward dataflow over single instructions, iterated until nothing
+// changes; loops are what take more than one pass. Needs `TARGETS` resolved
+// for the current `ASMS`.
+static u32 asms_liveness(void) {
+    LEN_WORDS = (LEN_VREGS + 63) / 64;
+    const u64 len = (u64)LEN_ASMS * LEN_WORDS;
+    LIVE_IN = ARENA_ALLOC(&ARENA_ASM, u64, len);
+    LIVE_OUT = ARENA_ALLOC(&ARENA_ASM, u64, len);
+    for (u64 i = 0; i < len; ++i) {
+        LIVE_IN[i] = 0;
+        LIVE_OUT[i] = 0;
+    }
+
+    for (Bool changed = TRUE; changed;) {
+        changed = FALSE;
+        for (u32 i = LEN_ASMS; i != 0;) {
+            const Asm* asm = &ASMS[--i];
+            u64*       in = &LIVE_IN[(u64)i * LEN_WORDS];
+            u64*       out = &LIVE_OUT[(u64)i * LEN_WORDS];
+            const u64* next = asm_falls_through(asm) && ((i + 1) < LEN_ASMS)
+                                  ? &LIVE_IN[(u64)(i + 1) * LEN_WORDS]
+                                  : NULL;
+            const u64* target = asm_is_jump(asm)
+                                    ? &LIVE_IN[(u64)TARGETS[i] * LEN_WORDS]
+                                    : NULL;
+            for (u32 j = 0; j < LEN_WORDS; ++j) {
+                out[j] = (next == NULL ? 0 : next[j]) |
+                         (target == NULL ? 0 : target[j]);
+            }
+
+            const u32 def = asm_def(asm);
+            u32       uses[2] = {VREG_NONE, VREG_NONE};
+            for (u32 j = 0; j < 2; ++j) {
+                if ((asm->args[j].type == ASM_ARG_VREG) &&
+                    ((j == 1) || asm_reads_first(asm->type)))
+                {
+                    uses[j] = asm->args[j].value.as_vreg;
+                }
+            }
+            for (u32 j = 0; j < LEN_WORDS; ++j) {
+                u64 word = out[j];
+                if ((def != VREG_NONE) && ((def / 64) == j)) {
+                    word &= ~(1lu << (def % 64));
+                }
+                for (u32 k = 0; k < 2; ++k) {
+                    if ((uses[k] != VREG_NONE) && ((uses[k] / 64) == j)) {
+                        word |= 1lu << (uses[k] % 64);
+                    }
+                }
+                if (word != in[j]) {
+                    in[j] = word;
+                    changed = TRUE;
+                }
+            }
+        }
+    }
+    return OK;
+}
+
+static u32* ALIASES = NULL;
+
+static u32 vreg_find(u32 vreg) {
+    while (ALIASES[vreg] != vreg) {
+        ALIASES[vreg] = ALIASES[ALIASES[vreg]];
+        vreg = ALIASES[vreg];
+    }
+    return vreg;
+}
+
+// NOTE: Two registers interfere if either is written while the other is
+// live afterwards, unless it is written with a copy of the other.
+static Bool vregs_interfere(u32 a, u32 b) {
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        const Asm* asm = &ASMS[i];
+        u32        def = asm_def(asm);
+        if (def == VREG_NONE) {
+            continue;
+        }
+        def = vreg_find(def);
+        if ((def != a) && (def != b)) {
+            continue;
+        }
+        const u32 other = def == a ? b : a;
+        if ((asm->type == ASM_MOV) && (asm->args[1].type == ASM_ARG_VREG) &&
+            (vreg_find(asm->args[1].value.as_vreg) == other))
+        {
+            continue;
+        }
+        if (live_has(&LIVE_OUT[(u64)i * LEN_WORDS], other)) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// NOTE: Merges the two sides of every copy that do not interfere, then
+// drops the copies left between a register and itself. Lowering relies on
+// this to turn phis back into updates in place.
+static u32 asms_coalesce(void) {
+    if ((asms_resolve() != OK) || (asms_liveness() != OK)) {
+        return ERROR;
+    }
+    ALIASES = ARENA_ALLOC(&ARENA_ASM, u32, LEN_VREGS);
+    for (u32 i = 0; i < LEN_VREGS; ++i) {
+        ALIASES[i] = i;
+    }
+
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        const Asm* asm = &ASMS[i];
+        if ((asm->type != ASM_MOV) || (asm->args[0].type != ASM_ARG_VREG) ||
+            (asm->args[1].type != ASM_ARG_VREG))
+        {
+            continue;
+        }
+        const u32 a = vreg_find(asm->args[0].value.as_vreg);
+        const u32 b = vreg_find(asm->args[1].value.as_vreg);
+        if ((a == b) || vregs_interfere(a, b)) {
+            continue;
+        }
+        ALIASES[b] = a;
+        for (u64 j = 0; j < ((u64)LEN_ASMS * LEN_WORDS); j += LEN_WORDS) {
+            if (live_has(&LIVE_IN[j], b)) {
+                live_set(&LIVE_IN[j], a);
+            }
+            if (live_has(&LIVE_OUT[j], b)) {
+                live_set(&LIVE_OUT[j], a);
+            }
+        }
+    }
+
+    u32 len_asms = 0;
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        Asm asm = ASMS[i];
+        for (u32 j = 0; j < 2; ++j) {
+            AsmArg* arg = &asm.args[j];
+            if (arg->type == ASM_ARG_VREG) {
+                arg->value.as_vreg = vreg_find(arg->value.as_vreg);
+            }
+        }
+        if ((asm.type == ASM_MOV) && (asm.args[0].type == ASM_ARG_VREG) &&
+            (asm.args[1].type == ASM_ARG_VREG) &&
+            (asm.args[0].value.as_vreg == asm.args[1].value.as_vreg))
+        {
+            continue;
+        }
+        ASMS[len_asms++] = asm;
+    }
+    LEN_ASMS = len_asms;
+    if (asms_resolve() != OK) {
+        return ERROR;
+    }
+    return asms_liveness();
+}
+
+// NOTE: The first and last instruction at which a virtual register is
+// mentioned or live; the hull of its live range.
+typedef struct {
+    u32 start;
+    u32 end;
+} Interval;
+
+static void interval_cover(Interval* interval, u32 i) {
+    if (i < interval->start) {
+        interval->start = i;
+    }
+    if (interval->end < i) {
+        interval->end = i;
+    }
+}
+
+// NOTE: Where the stack frame built by the prologue keeps spill slot `n`.
+static AsmArg spill_slot(u32 n) {
+    return (AsmArg){
+        .value = {.as_addr = {.base = ASM_REG_RSP,
+                              .offset = (i32)(n * sizeof(i64))}},
+        .type = ASM_ARG_ADDR,
+    };
+}
+
+static void asm_push(Asm* asms, u32* len_asms, Asm asm) {
+    asms[(*len_asms)++] = asm;
+}
+
+static void reg_push(Asm* asms, u32* len_asms, AsmType type, AsmArgReg reg) {
+    asm_push(asms,
+             len_asms,
+             (Asm){
+                 .args = {{.value = {.as_reg = reg}, .type = ASM_ARG_REG}},
+                 .type = type,
+             });
+}
+
+// NOTE: Linear scan: walks intervals in order of their start, hands out a
+// free register when there is one, and otherwise spills whichever live
+// interval ends last. `ASMS` is then rewritten onto the result, with a
+// prologue saving any callee-saved register used, and an epilogue before
+// every `ret`. Spilled operands that x86-64 cannot encode directly go through
+// `rax`.
+static u32 asms_allocate(void) {
+    Interval* intervals = ARENA_ALLOC(&ARENA_ASM, Interval, LEN_VREGS);
+    AsmArg*   assigned = ARENA_ALLOC(&ARENA_ASM, AsmArg, LEN_VREGS);
+    u32*      active = ARENA_ALLOC(&ARENA_ASM, u32, CAP_REGS);
+    u32       len_active = 0;
+    AsmArgReg pool[CAP_REGS];
+    u32       len_pool = 0;
+    Bool      saved[ASM_REG_R15 + 1] = {FALSE};
+    u32       len_spills = 0;
+
+    for (u32 i = 0; i < LEN_VREGS; ++i) {
+        intervals[i] = (Interval){.start = LEN_ASMS, .end = 0};
+    }
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        for (u32 j = 0; j < 2; ++j) {
+            if (ASMS[i].args[j].type == ASM_ARG_VREG) {
+                interval_cover(&intervals[ASMS[i].args[j].value.as_vreg], i);
+            }
+        }
+        const u64* live = &LIVE_IN[(u64)i * LEN_WORDS];
+        for (u32 j = 0; j < LEN_WORDS; ++j) {
+            for (u64 word = live[j]; word != 0; word &= word - 1) {
+                const u32 vreg = (64 * j) + (u32)__builtin_ctzll(word);
+                interval_cover(&intervals[vreg], i);
+            }
+        }
+    }
+
+    // NOTE: Counting sort by start; registers nothing mentions are left out.
+    u32* order = ARENA_ALLOC(&ARENA_ASM, u32, LEN_VREGS);
+    u32* starts = ARENA_ALLOC(&ARENA_ASM, u32, LEN_ASMS + 1);
+    u32  len_order = 0;
+    for (u32 i = 0; i <= LEN_ASMS; ++i) {
+        starts[i] = 0;
+    }
+    for (u32 i = 0; i < LEN_VREGS; ++i) {
+        if (intervals[i].start < LEN_ASMS) {
+            ++starts[intervals[i].start + 1];
+            ++len_order;
+        }
+    }
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        starts[i + 1] += starts[i];
+    }
+    for (u32 i = 0; i < LEN_VREGS; ++i) {
+        if (intervals[i].start < LEN_ASMS) {
+            order[starts[intervals[i].start]++] = i;
+        }
+    }
+
+    for (u32 i = CAP_REGS; i != 0;) {
+        pool[len_pool++] = REGS[--i];
+    }
+
+    for (u32 n = 0; n < len_order; ++n) {
+        const u32      i = order[n];
+        const Interval interval = intervals[i];
+
+        u32 kept = 0;
+        for (u32 j = 0; j < len_active; ++j) {
+            const u32 other = active[j];
+            if (intervals[other].end < interval.start) {
+                pool[len_pool++] = assigned[other].value.as_reg;
+            } else {
+                active[kept++] = other;
+            }
+        }
+        len_active = kept;
+
+        if (len_pool != 0) {
+            assigned[i] = (AsmArg){
+                .value = {.as_reg = pool[--len_pool]},
+                .type = ASM_ARG_REG,
+            };
+            active[len_active++] = i;
+            continue;
+        }
+
+        u32 last = 0;
+        for (u32 j = 1; j < len_active; ++j) {
+            if (intervals[active[last]].end < intervals[active[j]].end) {
+                last = j;
+            }
+        }
+        const u32 victim = active[last];
+        if (interval.end < intervals[victim].end) {
+            assigned[i] = assigned[victim];
+            assigned[victim] = spill_slot(len_spills++);
+            active[last] = i;
+        } else {
+            assigned[i] = spill_slot(len_spills++);
+        }
+    }
+
+    u32 len_saved = 0;
+    for (u32 i = 0; i < LEN_VREGS; ++i) {
+        if ((assigned[i].type == ASM_ARG_REG) &&
+            reg_is_saved(assigned[i].value.as_reg) &&
+            !saved[assigned[i].value.as_reg])
+        {
+            saved[assigned[i].value.as_reg] = TRUE;
+            ++len_saved;
+        }
+    }
+    if ((0x7FFFFFFF / sizeof(i64)) < len_spills) {
+        return ERROR;
+    }
+    const AsmArg frame = {
+        .value = {.as_i32 = (i32)(len_spills * sizeof(i64))},
+        .type = ASM_ARG_I32,
+    };
+
+    // NOTE: Every `Asm` becomes at most three, except `ret`, which also pops
+    // every saved register and the spill slots.
+    Asm* asms = ARENA_ALLOC(&ARENA_ASM,
+                            Asm,
+                            (3 * (u64)LEN_ASMS) +
+                                ((u64)(LEN_ASMS + 1) * (len_saved + 1)));
+    u32  len_asms = 0;
+
+    for (u32 i = 0; i <= ASM_REG_R15; ++i) {
+        if (saved[i]) {
+            reg_push(asms, &len_asms, ASM_PUSH, (AsmArgReg)i);
+        }
+    }
+    if (len_spills != 0) {
+        asm_push(asms,
+                 &len_asms,
+                 (Asm){
+                     .args = {{.value = {.as_reg = ASM_REG_RSP},
+                               .type = ASM_ARG_REG},
+                              frame},
+                     .type = ASM_SUB,
+                 });
+    }
+
+    const AsmArg rax = {.value = {.as_reg = ASM_REG_RAX}, .type = ASM_ARG_REG};
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        Asm asm = ASMS[i];
+        for (u32 j = 0; j < 2; ++j) {
+            if (asm.args[j].type == ASM_ARG_VREG) {
+                asm.args[j] = assigned[asm.args[j].value.as_vreg];
+            }
+        }
+
+        switch (asm.type) {
+        case ASM_RET: {
+            if (len_spills != 0) {
+                asm_push(asms,
+                         &len_asms,
+                         (Asm){
+                             .args = {{.value = {.as_reg = ASM_REG_RSP},
+                                       .type = ASM_ARG_REG},
+                                      frame},
+                             .type = ASM_ADD,
+                         });
+            }
+            for (u32 j = ASM_REG_R15 + 1; j != 0;) {
+                if (saved[--j]) {
+                    reg_push(asms, &len_asms, ASM_POP, (AsmArgReg)j);
+                }
+            }
+            asm_push(asms, &len_asms, asm);
+            break;
+        }
+        case ASM_SETL:
+        case ASM_SETE: {
+            if (asm.args[0].type == ASM_ARG_ADDR) {
+                const AsmArg slot = asm.args[0];
+                asm.args[0] = rax;
+                asm_push(asms, &len_asms, asm);
+                asm_push(asms,
+                         &len_asms,
+                         (Asm){.args = {slot, rax}, .type = ASM_MOV});
+                break;
+            }
+            asm_push(asms, &len_asms, asm);
+            break;
+        }
+        case ASM_IMUL:
+        case ASM_CMOVL:
+        case ASM_CMOVZ:
+        case ASM_CMOVNZ: {
+            if (asm.args[0].type == ASM_ARG_ADDR) {
+                const AsmArg slot = asm.args[0];
+                asm_push(asms,
+                         &len_asms,
+                         (Asm){.args = {rax, slot}, .type = ASM_MOV});
+                asm.args[0] = rax;
+                asm_push(asms, &len_asms, asm);
+                asm_push(asms,
+                         &len_asms,
+                         (Asm){.args = {slot, rax}, .type = ASM_MOV});
+                break;
+            }
+            asm_push(asms, &len_asms, asm);
+            break;
+        }
+        case ASM_MOV:
+        case ASM_TEST:
+        case ASM_CMP:
+        case ASM_AND:
+        case ASM_ADD:
+        case ASM_SUB: {
+            if ((asm.args[0].type == ASM_ARG_ADDR) &&
+                ((asm.args[1].type == ASM_ARG_ADDR) ||
+                 (asm.args[1].type == ASM_ARG_I64)))
+            {
+                asm_push(asms,
+                         &len_asms,
+                         (Asm){.args = {rax, asm.args[1]}, .type = ASM_MOV});
+                asm.args[1] = rax;
+            }
+            asm_push(asms, &len_asms, asm);
+            break;
+        }
+        case ASM_NOP:
+        case ASM_LABEL:
+        case ASM_JMP:
+        case ASM_JZ:
+        case ASM_JNZ:
+        case ASM_JGE:
+        case ASM_JL:
+        case ASM_SHR:
+        case ASM_PUSH:
+        case ASM_POP:
+        default: {
+            asm_push(asms, &len_asms, asm);
+        }
+        }
+    }
+
+    ASMS = asms;
+    LEN_ASMS = len_asms;
+    return OK;
+}
+
+// NOTE: Lowers the optimized `IR_BLOCKS`. The compiled code takes the
+// interpreter's frame in `rdi`, where every local lives at
+// `[rdi + (8 * slot)]`; each one is read into its own virtual register in the
+// entry block, carried through the loop in registers by the phi copies, and
+// written back just before every `ret`, which leaves in `eax` the instruction
+// the interpreter resumes at. Returns `ERROR`, rather than exiting, for
+// anything it cannot compile.
+u32 asm_emit(void) {
+    arena_reset(&ARENA_ASMS);
+    arena_reset(&ARENA_ASM);
+    ASMS = ARENA_ALLOC(&ARENA_ASMS, Asm, 0);
+    VREGS = ARENA_ALLOC(&ARENA_ASM, u32, LEN_IR_VALUES);
+    USES = ARENA_ALLOC(&ARENA_ASM, u32, LEN_IR_VALUES);
+    LABELS = ARENA_ALLOC(&ARENA_ASM, const char*, LEN_IR_BLOCKS);
+    LEN_ASMS = 0;
+    LEN_VREGS = 0;
+    LEN_BYTES = 0;
+
+    for (u32 i = 0; i < LEN_ESCAPES; ++i) {
+        if ((0x7FFFFFFF / sizeof(i64)) < ESCAPES[i]) {
+            return ERROR;
+        }
+    }
+    for (u32 i = 0; i < LEN_IR_VALUES; ++i) {
+        USES[i] = 0;
+    }
+
+    u32* layout = ARENA_ALLOC(&ARENA_ASM, u32, LEN_IR_BLOCKS);
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        const IrBlock* block = &IR_BLOCKS[i];
+        if (!block->reachable) {
+            continue;
+        }
+        for (u32 j = 0; j < block->len_values; ++j) {
+            const IrValue* value = &IR_VALUES[block->values[j]];
+            const u32      len_args = ir_len_args(value);
+            for (u32 k = 0; k < len_args; ++k) {
+                ++USES[value->args[k]];
+            }
+            if (value->op != IR_CONST) {
+                VREGS[block->values[j]] = vreg_alloc().value.as_vreg;
+            }
+        }
+        if (block->term == IR_JZ) {
+            ++USES[block->cond];
+        }
+        for (u32 j = 0; (block->term == IR_EXIT) && (j < LEN_ESCAPES); ++j) {
+            ++USES[block->outs[j]];
+        }
+        if (block_is_empty(i)) {
+            continue;
+        }
+        char* label = ARENA_ALLOC(&ARENA_ASM, char, 16);
+        EXIT_IF(15 < snprintf(label, 16, "b%u", i));
+        LABELS[i] = label;
+    }
+    const u32 len_layout = blocks_layout(layout);
+
+    const IrBlock* entry = &IR_BLOCKS[0];
+    for (u32 i = 0; i < entry->len_values; ++i) {
+        const IrValue* value = &IR_VALUES[entry->values[i]];
+        if (value->op != IR_PARAM) {
+            continue;
+        }
+        asm_binary_alloc(
+            ASM_MOV,
+            value_vreg(entry->values[i]),
+            (AsmArg){
+                .value = {.as_addr = {.base = ASM_REG_RDI,
+                                      .offset = (i32)(ESCAPES[value->local] *
+                                                      sizeof(i64))}},
+                .type = ASM_ARG_ADDR,
+            });
+    }
+    for (u32 i = 0; i < len_layout; ++i) {
+        const u32 next = (i + 1) < len_layout ? layout[i + 1] : 0;
+        if (block_to_asm(layout[i], next) != OK) {
+            return ERROR;
+        }
+    }
+    if (asms_coalesce() != OK) {
+        return ERROR;
+    }
+    if (asms_allocate() != OK) {
+        return ERROR;
+    }
+    if (asms_resolve() != OK) {
+        return ERROR;
+    }
+
+    BYTES = ARENA_ALLOC(&ARENA_ASM, u8, (u64)LEN_ASMS * CAP_ASM_BYTES);
+    OFFSETS = ARENA_ALLOC(&ARENA_ASM, u32, LEN_ASMS + 1);
+    FAR = ARENA_ALLOC(&ARENA_ASM, Bool, LEN_ASMS);
+    for (u32 i = 0; i < LEN_ASMS; ++i) {
+        FAR[i] = FALSE;
+    }
+    return asms_to_bytes();
+}
+
+static void code_map(void) {
+    const i32 file = (i32)syscall(SYS_memfd_create, "jist", 0);
+    EXIT_IF(file < 0);
+    EXIT_IF(ftruncate(file, CODE_RESERVE));
+    void* code = mmap(NULL,
+                      CODE_RESERVE,
                       PROT_READ | PROT_WRITE,
-                      MAP_ANONYMOUS | MAP_PRIVATE,
-                      -1,
+                      MAP_SHARED | MAP_NORESERVE,
+                      file,
+                      0);
+    EXIT_IF(code == MAP_FAILED);
+    void* exec = mmap(NULL,
+                      CODE_RESERVE,
+                      PROT_READ | PROT_EXEC,
+                      MAP_SHARED | MAP_NORESERVE,
+                      file,
                       0);
-    EXIT_IF(func == MAP_FAILED);
-    memcpy(func, BYTES, LEN_BYTES);
-    EXIT_IF(mprotect(func, LEN_BYTES, PROT_EXEC));
-    return func;
+    EXIT_IF(exec == MAP_FAILED);
+    EXIT_IF(close(file));
+    CODE = code;
+    CODE_EXEC = exec;
+}
+
+static void code_frees_remove(u32 i) {
+    --LEN_CODE_FREES;
+    memmove(&CODE_FREES[i],
+            &CODE_FREES[i + 1],
+            sizeof(CodeSpan) * (LEN_CODE_FREES - i));
+}
+
+static void code_frees_insert(u32 i, CodeSpan span) {
+    if (LEN_CODE_FREES == CAP_CODE_FREES) {
+        CodeSpan* free = ARENA_ALLOC(&ARENA_CODE_FREES, CodeSpan, 1);
+        if (CODE_FREES == NULL) {
+            CODE_FREES = free;
+        }
+        ++CAP_CODE_FREES;
+    }
+    memmove(&CODE_FREES[i + 1],
+            &CODE_FREES[i],
+            sizeof(CodeSpan) * (LEN_CODE_FREES - i));
+    CODE_FREES[i] = span;
+    ++LEN_CODE_FREES;
+}
+
+// NOTE: First fit out of `CODE_FREES`, and otherwise off the end.
+static CodeSpan code_alloc(u32 len) {
+    for (u32 i = 0; i < LEN_CODE_FREES; ++i) {
+        CodeSpan* free = &CODE_FREES[i];
+        if (free->len < len) {
+            continue;
+        }
+        const CodeSpan span = {.offset = free->offset, .len = len};
+        free->offset += len;
+        free->len -= len;
+        if (free->len == 0) {
+            code_frees_remove(i);
+        }
+        return span;
+    }
+    EXIT_IF((CODE_RESERVE - LEN_CODE) < len);
+    const CodeSpan span = {.offset = (u32)LEN_CODE, .len = len};
+    LEN_CODE += len;
+    return span;
+}
+
+void* asm_load(const u8* bytes, u32 len_bytes) {
+    if (CODE == NULL) {
+        code_map();
+    }
+    const u64 len =
+        (CODE_ALIGN + len_bytes + (CODE_ALIGN - 1)) & ~(CODE_ALIGN - 1);
+    EXIT_IF(CODE_RESERVE < len);
+    const CodeSpan span = code_alloc((u32)len);
+    memcpy(&CODE[span.offset], &span, sizeof(CodeSpan));
+    memcpy(&CODE[span.offset + CODE_ALIGN], bytes, len_bytes);
+    return &CODE_EXEC[span.offset + CODE_ALIGN];
+}
+
+void* asm_jit(void) {
+    return asm_load(BYTES, LEN_BYTES);
+}
+
+const u8* asm_bytes(u32* len_bytes) {
+    *len_bytes = LEN_BYTES;
+    return BYTES;
+}
+
+// NOTE: Joins the span to whichever free neighbours it touches, then gives
+// back to `LEN_CODE` whatever free span is left at the end.
+void asm_free(void* func) {
+    CodeSpan span;
+    memcpy(&span, (const u8*)func - CODE_ALIGN, sizeof(CodeSpan));
+    EXIT_IF(&CODE_EXEC[span.offset + CODE_ALIGN] != func);
+
+    u32 i = 0;
+    while ((i < LEN_CODE_FREES) && (CODE_FREES[i].offset < span.offset)) {
+        ++i;
+    }
+    if ((i != 0) &&
+        ((CODE_FREES[i - 1].offset + CODE_FREES[i - 1].len) == span.offset))
+    {
+        --i;
+        span.offset = CODE_FREES[i].offset;
+        span.len += CODE_FREES[i].len;
+        code_frees_remove(i);
+    }
+    if ((i < LEN_CODE_FREES) &&
+        ((span.offset + span.len) == CODE_FREES[i].offset))
+    {
+        span.len += CODE_FREES[i].len;
+        code_frees_remove(i);
+    }
+    code_frees_insert(i, span);
+
+    while ((LEN_CODE_FREES != 0) &&
+           ((CODE_FREES[LEN_CODE_FREES - 1].offset +
+             CODE_FREES[LEN_CODE_FREES - 1].len) == LEN_CODE))
+    {
+        LEN_CODE = CODE_FREES[--LEN_CODE_FREES].offset;
+    }
 }
 
 void asm_show(void) {
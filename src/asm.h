@@ -1,10 +1,13 @@
 #ifndef ASM_H
 #define ASM_H
 
-#include "expr.h"
+#include "ir.h"
 
-void  asm_emit(void);
-void* asm_jit(void);
-void  asm_show(void);
+u32       asm_emit(void);
+void*     asm_load(const u8*, u32);
+void*     asm_jit(void);
+void      asm_free(void*);
+void      asm_show(void);
+const u8* asm_bytes(u32*);
 
 #endif
@@ -0,0 +1,88 @@
+#include "asm.h"
+
+#include <time.h>
+
+#define INST_EMPTY(inst_type) ((Inst){.type = inst_type})
+#define INST_I64(inst_type, inst_arg) \
+    ((Inst){.type = inst_type, .value = {.as_i64 = inst_arg}})
+#define INST_CHARS(inst_type, inst_arg) \
+    ((Inst){.type = inst_type, .value = {.as_chars = inst_arg}})
+
+#define ITERATIONS (1 << 24)
+#define REPEATS    5
+
+#if (JIT_THRESHOLD != 0) && (IR_UNROLL == 1)
+    #define MODE "rolled"
+#elif JIT_THRESHOLD != 0
+    #define MODE "jit"
+#elif defined(THREADED)
+    #define MODE "threaded"
+#else
+    #define MODE "switch"
+#endif
+
+static const Inst INSTS[] = {
+    INST_I64(INST_PUSH, 0),
+    INST_CHARS(INST_ALLOC, "x"),
+    INST_I64(INST_PUSH, 0),
+    INST_CHARS(INST_ALLOC, "y"),
+
+    INST_CHARS(INST_LABEL, "while_start"),
+    INST_CHARS(INST_LOAD, "x"),
+    INST_I64(INST_PUSH, ITERATIONS),
+    INST_EMPTY(INST_LT),
+    INST_CHARS(INST_JZ, "while_end"),
+
+    INST_CHARS(INST_LOAD, "y"),
+    INST_CHARS(INST_LOAD, "x"),
+    INST_I64(INST_PUSH, 3),
+    INST_EMPTY(INST_AND),
+    INST_EMPTY(INST_ADD),
+    INST_CHARS(INST_STORE, "y"),
+
+    INST_CHARS(INST_LOAD, "x"),
+    INST_I64(INST_PUSH, 1),
+    INST_EMPTY(INST_ADD),
+    INST_CHARS(INST_STORE, "x"),
+    INST_CHARS(INST_JMP, "while_start"),
+
+    INST_CHARS(INST_LABEL, "while_end"),
+
+    INST_EMPTY(INST_HALT),
+};
+
+#define LEN_INSTS (sizeof(INSTS) / sizeof(INSTS[0]))
+
+// NOTE: Every iteration executes the 16 instructions from `while_start`
+// through `jmp`; the prologue, the failing loop test, and the epilogue add
+// another 11. `y` keeps the loop from being evaluated in closed form once it
+// is compiled, so the `jit` figures time the unrolled body itself.
+#define COUNT_INSTS ((16lu * ITERATIONS) + 11lu)
+
+static u64 now(void) {
+    struct timespec time;
+    EXIT_IF(clock_gettime(CLOCK_MONOTONIC, &time));
+    return ((u64)time.tv_sec * 1000000000lu) + (u64)time.tv_nsec;
+}
+
+i32 main(void) {
+    insts_setup(INSTS, LEN_INSTS);
+
+    u64 best = 0xFFFFFFFFFFFFFFFF;
+    for (u32 i = 0; i < REPEATS; ++i) {
+        const u64 start = now();
+        insts_run();
+        const u64 elapsed = now() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("%-8s %10lu insts %6.3f ns/inst %7.3f ns/iter\n",
+           MODE,
+           COUNT_INSTS,
+           (f64)best / (f64)COUNT_INSTS,
+           (f64)best / (f64)ITERATIONS);
+
+    return OK;
+}
@@ -0,0 +1,94 @@
+#include "arena.h"
+#include "asm.h"
+
+#include <time.h>
+
+#define INST_EMPTY(inst_type) ((Inst){.type = inst_type})
+#define INST_I64(inst_type, inst_arg) \
+    ((Inst){.type = inst_type, .value = {.as_i64 = inst_arg}})
+#define INST_CHARS(inst_type, inst_arg) \
+    ((Inst){.type = inst_type, .value = {.as_chars = inst_arg}})
+
+#define MIN_LABELS (1u << 10)
+#define MAX_LABELS (1u << 20)
+#define REPEATS    3
+
+static Arena ARENA = {0};
+
+static u64 now(void) {
+    struct timespec time;
+    EXIT_IF(clock_gettime(CLOCK_MONOTONIC, &time));
+    return ((u64)time.tv_sec * 1000000000lu) + (u64)time.tv_nsec;
+}
+
+// NOTE: One loop whose body is a chain of `len_labels` labels, each jumping
+// to the next, so every label is defined once and referenced once by both
+// `insts_setup` and `asm_emit`.
+static u32 insts_chain(Inst* insts, u32 len_labels) {
+    u32 n = 0;
+    insts[n++] = INST_I64(INST_PUSH, 0);
+    insts[n++] = INST_CHARS(INST_ALLOC, "i");
+
+    insts[n++] = INST_CHARS(INST_LABEL, "loop_start");
+    insts[n++] = INST_CHARS(INST_LOAD, "i");
+    insts[n++] = INST_I64(INST_PUSH, 1);
+    insts[n++] = INST_EMPTY(INST_LT);
+    insts[n++] = INST_CHARS(INST_JZ, "loop_end");
+
+    for (u32 i = 0; i < len_labels; ++i) {
+        char* label = ARENA_ALLOC(&ARENA, char, 16);
+        EXIT_IF(15 < snprintf(label, 16, "l%u", i));
+        if (i != 0) {
+            insts[n++] = INST_CHARS(INST_JMP, label);
+        }
+        insts[n++] = INST_CHARS(INST_LABEL, label);
+    }
+
+    insts[n++] = INST_CHARS(INST_LOAD, "i");
+    insts[n++] = INST_I64(INST_PUSH, 1);
+    insts[n++] = INST_EMPTY(INST_ADD);
+    insts[n++] = INST_CHARS(INST_STORE, "i");
+    insts[n++] = INST_CHARS(INST_JMP, "loop_start");
+
+    insts[n++] = INST_CHARS(INST_LABEL, "loop_end");
+    insts[n++] = INST_EMPTY(INST_HALT);
+    return n;
+}
+
+i32 main(void) {
+    printf("%10s %12s %12s\n", "labels", "setup", "emit");
+    for (u32 len_labels = MIN_LABELS; len_labels <= MAX_LABELS;
+         len_labels <<= 2)
+    {
+        arena_reset(&ARENA);
+        Inst*     insts = ARENA_ALLOC(&ARENA, Inst, (len_labels * 2) + 16);
+        const u32 len_insts = insts_chain(insts, len_labels);
+
+        u64 best_setup = 0xFFFFFFFFFFFFFFFF;
+        u64 best_emit = 0xFFFFFFFFFFFFFFFF;
+        for (u32 i = 0; i < REPEATS; ++i) {
+            const u64 start = now();
+            insts_setup(insts, len_insts);
+            const u64 middle = now();
+            EXIT_IF(exprs_parse(2, len_insts - 1) != OK);
+            EXIT_IF(ir_build() != OK);
+            ir_optimize();
+            EXIT_IF(asm_emit() != OK);
+            const u64 end = now();
+
+            if ((middle - start) < best_setup) {
+                best_setup = middle - start;
+            }
+            if ((end - middle) < best_emit) {
+                best_emit = end - middle;
+            }
+        }
+
+        printf("%10u %9.1f ns %9.1f ns  (per label)\n",
+               len_labels,
+               (f64)best_setup / (f64)len_labels,
+               (f64)best_emit / (f64)len_labels);
+    }
+
+    return OK;
+}
@@ -0,0 +1,336 @@
+#include "arena.h"
+#include "bytecode.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// NOTE: Owns the source text and the `Inst` array parsed from it; reset by
+// every `bytecode_assemble`.
+static Arena ARENA_TEXT = {0};
+
+static char* TEXT = NULL;
+
+static Inst* INSTS = NULL;
+static u32   LEN_INSTS = 0;
+
+typedef struct {
+    const char* name;
+    InstType    type;
+} Mnemonic;
+
+static const Mnemonic MNEMONICS[] = {
+    {"halt", INST_HALT},
+    {"alloc", INST_ALLOC},
+    {"load", INST_LOAD},
+    {"store", INST_STORE},
+    {"push", INST_PUSH},
+    {"jmp", INST_JMP},
+    {"jz", INST_JZ},
+    {"lt", INST_LT},
+    {"eq", INST_EQ},
+    {"and", INST_AND},
+    {"add", INST_ADD},
+    {"println_i64", INST_PRINTLN_I64},
+};
+
+#define LEN_MNEMONICS (sizeof(MNEMONICS) / sizeof(MNEMONICS[0]))
+
+static Inst* inst_alloc(void) {
+    return &INSTS[LEN_INSTS++];
+}
+
+static Bool is_space(char c) {
+    return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+static Bool is_digit(char c) {
+    return ('0' <= c) && (c <= '9');
+}
+
+static char* token_next(char** cursor) {
+    char* token = *cursor;
+    for (; is_space(*token); ++token) {
+    }
+    if (*token == '\0') {
+        return NULL;
+    }
+    char* end = token;
+    for (; (*end != '\0') && !is_space(*end); ++end) {
+    }
+    if (*end != '\0') {
+        *(end++) = '\0';
+    }
+    *cursor = end;
+    return token;
+}
+
+static i64 i64_parse(const char* token) {
+    char* end = NULL;
+    const i64 value = strtoll(token, &end, 10);
+    EXIT_IF((end == token) || (*end != '\0'));
+    return value;
+}
+
+static void line_parse(char* line) {
+    for (char* c = line; *c != '\0'; ++c) {
+        if (*c == '#') {
+            *c = '\0';
+            break;
+        }
+    }
+
+    char* cursor = line;
+    char* token = token_next(&cursor);
+    if (token == NULL) {
+        return;
+    }
+
+    const u32 n = len(token);
+    if (token[n - 1] == ':') {
+        EXIT_IF(n == 1);
+        EXIT_IF(is_digit(token[0]));
+        EXIT_IF(token_next(&cursor) != NULL);
+        token[n - 1] = '\0';
+        *inst_alloc() = (Inst){
+            .value = {.as_chars = token},
+            .type = INST_LABEL,
+        };
+        return;
+    }
+
+    u32 i = 0;
+    for (; i < LEN_MNEMONICS; ++i) {
+        if (eq(token, MNEMONICS[i].name)) {
+            break;
+        }
+    }
+    EXIT_IF(i == LEN_MNEMONICS);
+
+    Inst* inst = inst_alloc();
+    inst->type = MNEMONICS[i].type;
+
+    const char* operand = token_next(&cursor);
+    switch (inst->type) {
+    case INST_ALLOC:
+    case INST_LOAD:
+    case INST_STORE:
+    case INST_JMP:
+    case INST_JZ: {
+        EXIT_IF(operand == NULL);
+        inst->value.as_chars = operand;
+        break;
+    }
+    case INST_PUSH: {
+        EXIT_IF(operand == NULL);
+        inst->value.as_i64 = i64_parse(operand);
+        break;
+    }
+    case INST_HALT:
+    case INST_LT:
+    case INST_EQ:
+    case INST_AND:
+    case INST_ADD:
+    case INST_PRINTLN_I64: {
+        EXIT_IF(operand != NULL);
+        break;
+    }
+    case INST_LABEL:
+    case INST_ADD_LOCAL_IMM:
+    case INST_JGE_LOCAL_IMM:
+    case INST_JNZ_TESTBIT_LOCAL:
+    default: {
+        EXIT();
+    }
+    }
+    EXIT_IF(token_next(&cursor) != NULL);
+}
+
+// NOTE: Accepts the syntax `insts_show` prints; jump operands may name a
+// label or give the index of one, as `jz 25` does, and no label name starts
+// with a digit. Each line holds at most one instruction, so `INSTS` is sized
+// by the line count.
+void bytecode_assemble(const char* path) {
+    FILE* file = fopen(path, "r");
+    EXIT_IF(file == NULL);
+    struct stat info;
+    EXIT_IF(fstat(fileno(file), &info));
+    EXIT_IF(info.st_size < 0);
+    const u64 size = (u64)info.st_size;
+
+    arena_reset(&ARENA_TEXT);
+    TEXT = ARENA_ALLOC(&ARENA_TEXT, char, size + 1);
+    const size_t n = fread(TEXT, sizeof(char), size, file);
+    EXIT_IF(ferror(file));
+    EXIT_IF(n != size);
+    EXIT_IF(fclose(file));
+    TEXT[n] = '\0';
+
+    u64 len_lines = 1;
+    for (u64 i = 0; i < n; ++i) {
+        if (TEXT[i] == '\n') {
+            ++len_lines;
+        }
+    }
+    EXIT_IF(0xFFFFFFFF < len_lines);
+    INSTS = ARENA_ALLOC(&ARENA_TEXT, Inst, len_lines);
+    LEN_INSTS = 0;
+    for (char* line = TEXT; line != NULL;) {
+        char* next = line;
+        for (; (*next != '\0') && (*next != '\n'); ++next) {
+        }
+        if (*next == '\n') {
+            *(next++) = '\0';
+        } else {
+            next = NULL;
+        }
+        line_parse(line);
+        line = next;
+    }
+
+    for (u32 i = 0; i < LEN_INSTS; ++i) {
+        Inst* inst = &INSTS[i];
+        if (((inst->type != INST_JMP) && (inst->type != INST_JZ)) ||
+            !is_digit(inst->value.as_chars[0]))
+        {
+            continue;
+        }
+        const i64 target = i64_parse(inst->value.as_chars);
+        EXIT_IF((target < 0) || (LEN_INSTS <= target));
+        EXIT_IF(INSTS[target].type != INST_LABEL);
+        inst->value.as_chars = INSTS[target].value.as_chars;
+    }
+
+    insts_setup(INSTS, LEN_INSTS);
+}
+
+static void section_write(FILE* file, const void* section, size_t size) {
+    EXIT_IF(fwrite(section, 1, size, file) != size);
+}
+
+void bytecode_write(const char* path) {
+    const BytecodeHeader header = {
+        .magic = BYTECODE_MAGIC,
+        .version = BYTECODE_VERSION,
+        .len = PROGRAM.len,
+        .len_consts = PROGRAM.len_consts,
+        .len_symbols = PROGRAM.len_symbols,
+        .len_locals = PROGRAM.len_locals,
+        .len_chars = PROGRAM.len_chars,
+        .reserved = 0,
+    };
+
+    FILE* file = fopen(path, "wb");
+    EXIT_IF(file == NULL);
+    section_write(file, &header, sizeof(header));
+    section_write(file, PROGRAM.consts, sizeof(i64) * header.len_consts);
+    section_write(file, PROGRAM.args, sizeof(u32) * header.len);
+    section_write(file, PROGRAM.symbols, sizeof(u32) * header.len_symbols);
+    section_write(file, PROGRAM.types, sizeof(u8) * header.len);
+    section_write(file, PROGRAM.chars, sizeof(char) * header.len_chars);
+    EXIT_IF(fclose(file));
+}
+
+// NOTE: Checks every operand against its section so that a corrupt file is
+// rejected here rather than indexing out of bounds in `insts_run`.
+static void bytecode_validate(void) {
+    EXIT_IF(PROGRAM.len == 0);
+    EXIT_IF(PROGRAM.len_symbols < PROGRAM.len_locals);
+    EXIT_IF(PROGRAM.len_chars == 0);
+    EXIT_IF(PROGRAM.chars[PROGRAM.len_chars - 1] != '\0');
+
+    for (u32 i = 0; i < PROGRAM.len_symbols; ++i) {
+        EXIT_IF(PROGRAM.len_chars <= PROGRAM.symbols[i]);
+    }
+
+    for (u32 i = 0; i < PROGRAM.len; ++i) {
+        const u32 arg = PROGRAM.args[i];
+        EXIT_IF(INST_PRINTLN_I64 < PROGRAM.types[i]);
+        switch ((InstType)PROGRAM.types[i]) {
+        case INST_LABEL: {
+            EXIT_IF(arg < PROGRAM.len_locals);
+            EXIT_IF(PROGRAM.len_symbols <= arg);
+            break;
+        }
+        case INST_ALLOC:
+        case INST_LOAD:
+        case INST_STORE: {
+            EXIT_IF(PROGRAM.len_locals <= arg);
+            break;
+        }
+        case INST_PUSH: {
+            EXIT_IF(PROGRAM.len_consts <= arg);
+            break;
+        }
+        case INST_JMP:
+        case INST_JZ: {
+            EXIT_IF(PROGRAM.len <= arg);
+            EXIT_IF(PROGRAM.types[arg] != INST_LABEL);
+            break;
+        }
+        case INST_HALT:
+        case INST_LT:
+        case INST_EQ:
+        case INST_AND:
+        case INST_ADD:
+        case INST_PRINTLN_I64: {
+            EXIT_IF(arg != 0);
+            break;
+        }
+        case INST_ADD_LOCAL_IMM:
+        case INST_JGE_LOCAL_IMM:
+        case INST_JNZ_TESTBIT_LOCAL:
+        default: {
+            EXIT();
+        }
+        }
+    }
+}
+
+static const void* section(const u8* bytes, u64 offset) {
+    return &bytes[offset];
+}
+
+// NOTE: The mapping is never copied or unmapped; `PROGRAM` points straight
+// into it for the rest of the process.
+void bytecode_load(const char* path) {
+    const i32 file = open(path, O_RDONLY);
+    EXIT_IF(file < 0);
+    struct stat info;
+    EXIT_IF(fstat(file, &info));
+    EXIT_IF(info.st_size < (i64)sizeof(BytecodeHeader));
+    const u64 size = (u64)info.st_size;
+
+    const u8* bytes = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    EXIT_IF(bytes == MAP_FAILED);
+    EXIT_IF(close(file));
+
+    const BytecodeHeader* header = section(bytes, 0);
+    EXIT_IF(header->magic != BYTECODE_MAGIC);
+    EXIT_IF(header->version != BYTECODE_VERSION);
+
+    const u64 offset_args =
+        sizeof(BytecodeHeader) + (sizeof(i64) * header->len_consts);
+    const u64 offset_symbols = offset_args + (sizeof(u32) * header->len);
+    const u64 offset_types =
+        offset_symbols + (sizeof(u32) * header->len_symbols);
+    const u64 offset_chars = offset_types + (sizeof(u8) * header->len);
+    EXIT_IF(size != (offset_chars + (sizeof(char) * header->len_chars)));
+
+    PROGRAM = (Program){
+        .types = section(bytes, offset_types),
+        .args = section(bytes, offset_args),
+        .consts = section(bytes, sizeof(BytecodeHeader)),
+        .symbols = section(bytes, offset_symbols),
+        .chars = section(bytes, offset_chars),
+        .len = header->len,
+        .len_consts = header->len_consts,
+        .len_symbols = header->len_symbols,
+        .len_locals = header->len_locals,
+        .len_chars = header->len_chars,
+    };
+
+    bytecode_validate();
+    insts_prepare();
+}
@@ -0,0 +1,29 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "inst.h"
+
+#define BYTECODE_MAGIC   0x5453494A
+#define BYTECODE_VERSION 1
+
+// NOTE: A file is this header followed by `consts`, `args`, `symbols`,
+// `types`, and `chars`, each packed and in that order, so every section is
+// naturally aligned in a page-aligned mapping.
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 len;
+    u32 len_consts;
+    u32 len_symbols;
+    u32 len_locals;
+    u32 len_chars;
+    u32 reserved;
+} BytecodeHeader;
+
+STATIC_ASSERT((sizeof(BytecodeHeader) % sizeof(i64)) == 0);
+
+void bytecode_assemble(const char*);
+void bytecode_write(const char*);
+void bytecode_load(const char*);
+
+#endif
@@ -0,0 +1,204 @@
+#include "arena.h"
+#include "asm.h"
+#include "cache.h"
+#include "table.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// NOTE: Owns `WORDS`; reset by every `cache_load` and `cache_store`.
+static Arena ARENA_CACHE = {0};
+
+// NOTE: Where compiled loops are kept, one file each, named for the key of
+// the range they were compiled from; `NULL` leaves the cache off.
+static const char* DIRECTORY = NULL;
+
+#define CAP_CACHE_PATH 4096
+
+// NOTE: The fingerprint of the range being looked up.
+static u64* WORDS = NULL;
+static u32  LEN_WORDS = 0;
+
+// NOTE: What the code compiled for a range must match: the version, the
+// settings `ir_optimize` was built with, where the range starts, since exits
+// return absolute instructions, and each instruction's type and what its
+// argument stands for. Slots and targets are kept as they are, a constant by
+// its value, and a label not at all, so a loop still matches when the pools
+// around it are laid out differently. The code also depends on the `JUMPS`
+// profile, through block layout and `ir_select`, which is deliberately left
+// out; a file compiled under another profile is slower, never wrong.
+static void words_fingerprint(u32 start, u32 end) {
+    arena_reset(&ARENA_CACHE);
+    WORDS = ARENA_ALLOC(&ARENA_CACHE, u64, 7 + (2 * (u64)(end - start)));
+    LEN_WORDS = 0;
+    WORDS[LEN_WORDS++] = CACHE_VERSION;
+    WORDS[LEN_WORDS++] = IR_ROUNDS;
+    WORDS[LEN_WORDS++] = IR_UNROLL;
+    WORDS[LEN_WORDS++] = UNROLL_VALUES;
+    WORDS[LEN_WORDS++] = SELECT_VALUES;
+    WORDS[LEN_WORDS++] = SELECT_BIAS;
+    WORDS[LEN_WORDS++] = start;
+    for (u32 i = start; i < end; ++i) {
+        const InstType type = (InstType)PROGRAM.types[i];
+        u64            arg = 0;
+        switch (type) {
+        case INST_ALLOC:
+        case INST_LOAD:
+        case INST_STORE:
+        case INST_JMP:
+        case INST_JZ: {
+            arg = PROGRAM.args[i];
+            break;
+        }
+        case INST_PUSH: {
+            arg = (u64)PROGRAM.consts[PROGRAM.args[i]];
+            break;
+        }
+        case INST_HALT:
+        case INST_LABEL:
+        case INST_LT:
+        case INST_EQ:
+        case INST_AND:
+        case INST_ADD:
+        case INST_PRINTLN_I64: {
+            break;
+        }
+        case INST_ADD_LOCAL_IMM:
+        case INST_JGE_LOCAL_IMM:
+        case INST_JNZ_TESTBIT_LOCAL:
+        default: {
+            EXIT();
+        }
+        }
+        WORDS[LEN_WORDS++] = (u64)type;
+        WORDS[LEN_WORDS++] = arg;
+    }
+}
+
+static u32 words_key(void) {
+    return hash_bytes(HASH_SEED, WORDS, sizeof(u64) * (u64)LEN_WORDS);
+}
+
+static void cache_path(char* path, u32 key) {
+    EXIT_IF((CAP_CACHE_PATH - 1) <
+            snprintf(path, CAP_CACHE_PATH, "%s/%08x.jit", DIRECTORY, key));
+}
+
+void cache_open(const char* directory) {
+    EXIT_IF((CAP_CACHE_PATH - 32) < len(directory));
+    EXIT_IF(mkdir(directory, 0755) && (errno != EEXIST));
+    DIRECTORY = directory;
+}
+
+// NOTE: The code in a mapped file, or `NULL` if anything about it is off;
+// the fingerprint must match word for word, not just its key.
+static const u8* cache_code(const u8* bytes, u64 size, u32 key) {
+    const CacheHeader* header = (const void*)bytes;
+    if ((header->magic != CACHE_MAGIC) || (header->version != CACHE_VERSION) ||
+        (header->key != key) || (header->len_words != LEN_WORDS) ||
+        (header->len_relocs != 0) || (header->len_bytes == 0))
+    {
+        return NULL;
+    }
+    const u64 offset_words = sizeof(CacheHeader);
+    const u64 offset_code = offset_words + (sizeof(u64) * LEN_WORDS);
+    if (size != (offset_code + header->len_bytes)) {
+        return NULL;
+    }
+    if (memcmp(&bytes[offset_words], WORDS, sizeof(u64) * LEN_WORDS) != 0) {
+        return NULL;
+    }
+    const u8* code = &bytes[offset_code];
+    if (hash_bytes(HASH_SEED, code, header->len_bytes) != header->checksum) {
+        return NULL;
+    }
+    return code;
+}
+
+// NOTE: Returns the loop compiled from `start` up to `end` if an earlier run
+// left it in the cache, copied into the code arena, and otherwise `NULL`, in
+// which case the caller compiles it as usual.
+void* cache_load(u32 start, u32 end) {
+    if (DIRECTORY == NULL) {
+        return NULL;
+    }
+    words_fingerprint(start, end);
+    const u32 key = words_key();
+    char      path[CAP_CACHE_PATH];
+    cache_path(path, key);
+
+    const i32 file = open(path, O_RDONLY);
+    if (file < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(file, &info) || (info.st_size < (i64)sizeof(CacheHeader))) {
+        EXIT_IF(close(file));
+        return NULL;
+    }
+    const u64 size = (u64)info.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    EXIT_IF(close(file));
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    const CacheHeader* header = mapping;
+    const u8*          code = cache_code(mapping, size, key);
+    void*              func = NULL;
+    if (code != NULL) {
+        func = asm_load(code, header->len_bytes);
+    }
+    EXIT_IF(munmap(mapping, size));
+    return func;
+}
+
+static Bool section_write(FILE* file, const void* section, size_t size) {
+    return fwrite(section, 1, size, file) == size;
+}
+
+// NOTE: Keeps the code `asm_emit` just made for the range from `start` up to
+// `end`. The file is written aside and renamed into place, so a process
+// reading the cache concurrently sees it whole or not at all; failing to
+// write it only costs the next run a compile.
+void cache_store(u32 start, u32 end) {
+    if (DIRECTORY == NULL) {
+        return;
+    }
+    words_fingerprint(start, end);
+    u32       len_bytes;
+    const u8* bytes = asm_bytes(&len_bytes);
+    const u32 key = words_key();
+
+    const CacheHeader header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .key = key,
+        .len_words = LEN_WORDS,
+        .len_relocs = 0,
+        .len_bytes = len_bytes,
+        .checksum = hash_bytes(HASH_SEED, bytes, len_bytes),
+        .reserved = 0,
+    };
+
+    char path[CAP_CACHE_PATH];
+    char temp[CAP_CACHE_PATH];
+    cache_path(path, key);
+    EXIT_IF((CAP_CACHE_PATH - 1) <
+            snprintf(temp, CAP_CACHE_PATH, "%s.%d", path, getpid()));
+
+    FILE* file = fopen(temp, "wb");
+    if (file == NULL) {
+        return;
+    }
+    const Bool written =
+        section_write(file, &header, sizeof(header)) &&
+        section_write(file, WORDS, sizeof(u64) * LEN_WORDS) &&
+        section_write(file, bytes, len_bytes);
+    if ((fclose(file) != 0) || !written || (rename(temp, path) != 0)) {
+        unlink(temp);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "inst.h"
+
+#define CACHE_MAGIC 0x4354494A
+
+// NOTE: Bump whenever what compiled code expects of the interpreter changes,
+// or the code for a given loop might; every file made before is then
+// rejected.
+#define CACHE_VERSION 2
+
+// NOTE: A file is this header followed by the `len_words` words of the
+// fingerprint its code was compiled from, `len_relocs` relocations, and
+// `len_bytes` of code. Compiled code only ever jumps within itself and
+// reaches the frame through `rdi`, so nothing needs relocating yet, and a
+// file with any relocation is rejected.
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 key;
+    u32 len_words;
+    u32 len_relocs;
+    u32 len_bytes;
+    u32 checksum;
+    u32 reserved;
+} CacheHeader;
+
+STATIC_ASSERT((sizeof(CacheHeader) % sizeof(u64)) == 0);
+
+void  cache_open(const char*);
+void* cache_load(u32, u32);
+void  cache_store(u32, u32);
+
+#endif
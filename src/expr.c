@@ -1,26 +1,83 @@
+#include "arena.h"
 #include "expr.h"
+#include "table.h"
 
-#define CAP_EXPRS (1 << 5)
-static Expr EXPRS[CAP_EXPRS];
-static u32  LEN_EXPRS = 0;
+// NOTE: Owns every `Expr` along with `LIST` and `ESCAPES`; reset by every
+// `exprs_parse`.
+static Arena ARENA_EXPRS = {0};
+
+u32* ESCAPES = NULL;
+u32  LEN_ESCAPES = 0;
+
+const Expr** LIST = NULL;
+u32          LEN_LIST = 0;
+
+// NOTE: Hash consing. Every operand built since the last store or label is
+// kept here by its type and values, so a load, constant, or operator that
+// the range computes more than once is one node. Nodes are met last to
+// first, so `REGION` moves on as a store or label is met; a slot holding a
+// node from an earlier region counts as empty.
+static Expr** CONSES = NULL;
+static u32*   CONS_REGIONS = NULL;
+static u32    CAP_CONSES = 0;
+static u32    REGION = 0;
 
 static Expr* expr_alloc(void) {
-    EXIT_IF(CAP_EXPRS <= LEN_EXPRS);
-    return &EXPRS[LEN_EXPRS++];
+    return ARENA_ALLOC(&ARENA_EXPRS, Expr, 1);
+}
+
+// NOTE: Room for `len` nodes, at most one per instruction parsed.
+static void conses_init(u32 len) {
+    CAP_CONSES = 1 << 3;
+    while (CAP_CONSES < (2 * (u64)len)) {
+        CAP_CONSES <<= 1;
+    }
+    CONSES = ARENA_ALLOC(&ARENA_EXPRS, Expr*, CAP_CONSES);
+    CONS_REGIONS = ARENA_ALLOC(&ARENA_EXPRS, u32, CAP_CONSES);
+    for (u32 i = 0; i < CAP_CONSES; ++i) {
+        CONSES[i] = NULL;
+    }
+    REGION = 0;
 }
 
-static void escape_push(const char* escape) {
+static u32 expr_hash(const Expr* expr) {
+    u32 hash = hash_word(HASH_SEED, (u64)expr->type);
+    hash = hash_word(hash, (u64)expr->values[0].as_i64);
+    return hash_word(hash, (u64)expr->values[1].as_i64);
+}
+
+// NOTE: The node of this region equal to `expr`, which has both values set,
+// or else a new one.
+static Expr* expr_cons(Expr expr) {
+    u32 k = expr_hash(&expr) & (CAP_CONSES - 1);
+    for (; (CONSES[k] != NULL) && (CONS_REGIONS[k] == REGION);
+         k = (k + 1) & (CAP_CONSES - 1))
+    {
+        const Expr* other = CONSES[k];
+        if ((other->type == expr.type) &&
+            (other->values[0].as_i64 == expr.values[0].as_i64) &&
+            (other->values[1].as_i64 == expr.values[1].as_i64))
+        {
+            return CONSES[k];
+        }
+    }
+    Expr* node = expr_alloc();
+    *node = expr;
+    CONSES[k] = node;
+    CONS_REGIONS[k] = REGION;
+    return node;
+}
+
+static void escape_push(u32 slot) {
     for (u32 j = 0; j < LEN_ESCAPES; ++j) {
-        if (eq(escape, ESCAPES[j])) {
+        if (ESCAPES[j] == slot) {
             return;
         }
     }
-    EXIT_IF(CAP_ESCAPES <= LEN_ESCAPES);
-    ESCAPES[LEN_ESCAPES++] = escape;
+    ESCAPES[LEN_ESCAPES++] = slot;
 }
 
 static void list_push(const Expr* expr) {
-    EXIT_IF(CAP_LIST <= LEN_LIST);
     LIST[LEN_LIST++] = expr;
 }
 
@@ -34,8 +91,8 @@ static void expr_print(Expr expr) {
         printf("%ld", expr.values[0].as_i64);
         break;
     }
-    case EXPR_RET: {
-        printf("ret()");
+    case EXPR_EXIT: {
+        printf("exit(%ld)", expr.values[0].as_i64);
         break;
     }
     case EXPR_LABEL: {
@@ -100,109 +157,296 @@ static void expr_print(Expr expr) {
     }
 }
 
-static Expr* insts_to_expr(const Inst* insts, u32* i, u32 end) {
-    EXIT_IF(*i <= end);
-    const Inst inst = insts[--(*i)];
-    switch (inst.type) {
-    case INST_HALT: {
-        EXIT();
+static Bool expr_is_value(const Expr* expr) {
+    switch (expr->type) {
+    case EXPR_IDENT:
+    case EXPR_I64:
+    case EXPR_LOAD:
+    case EXPR_LT:
+    case EXPR_EQ:
+    case EXPR_AND:
+    case EXPR_ADD: {
+        return TRUE;
     }
+    case EXPR_EXIT:
+    case EXPR_LABEL:
+    case EXPR_STORE:
+    case EXPR_JMP:
+    case EXPR_JZ:
+    default: {
+        return FALSE;
+    }
+    }
+}
+
+static Expr* insts_to_expr(const u32*, u32*, u32);
+
+// NOTE: An operand must be produced by the instructions directly before its
+// consumer; anything else means the stack carried values across a statement,
+// which the tree form cannot express.
+static Expr* insts_to_value(const u32* insts, u32* i, u32 end) {
+    Expr* expr = insts_to_expr(insts, i, end);
+    if ((expr == NULL) || !expr_is_value(expr)) {
+        return NULL;
+    }
+    return expr;
+}
+
+static Expr* insts_to_binary(const u32* insts,
+                             u32*       i,
+                             u32        end,
+                             ExprType   type) {
+    Expr expr = {0};
+    expr.values[1].as_expr = insts_to_value(insts, i, end);
+    if (expr.values[1].as_expr == NULL) {
+        return NULL;
+    }
+    expr.values[0].as_expr = insts_to_value(insts, i, end);
+    if (expr.values[0].as_expr == NULL) {
+        return NULL;
+    }
+    expr.type = type;
+    return expr_cons(expr);
+}
+
+// NOTE: Parses backwards from position `*i` of `insts`, a list of
+// instruction indices, stopping at position `end`. Returns `NULL` for
+// anything the tree form cannot express, so callers can leave that code to
+// the interpreter.
+static Expr* insts_to_expr(const u32* insts, u32* i, u32 end) {
+    if (*i <= end) {
+        return NULL;
+    }
+    const u32 inst = insts[--(*i)];
+    const u32 arg = PROGRAM.args[inst];
+    switch ((InstType)PROGRAM.types[inst]) {
     case INST_LABEL: {
+        ++REGION;
+
         Expr* expr = expr_alloc();
-        expr->values[0].as_chars = inst.value.as_chars;
+        expr->values[0].as_chars = insts_symbol(arg);
+        expr->values[1].as_i64 = JUMPS[inst];
         expr->type = EXPR_LABEL;
         return expr;
     }
-    case INST_ALLOC: {
-        EXIT();
-    }
     case INST_LOAD: {
-        escape_push(inst.value.as_chars);
+        escape_push(arg);
 
-        Expr* expr = expr_alloc();
-        expr->values[0].as_chars = inst.value.as_chars;
-        expr->type = EXPR_LOAD;
-        return expr;
+        Expr expr = {0};
+        expr.values[0].as_chars = insts_symbol(arg);
+        expr.values[1].as_i64 = 0;
+        expr.type = EXPR_LOAD;
+        return expr_cons(expr);
     }
     case INST_STORE: {
-        escape_push(inst.value.as_chars);
+        escape_push(arg);
+        ++REGION;
 
         Expr* expr = expr_alloc();
-        expr->values[0].as_chars = inst.value.as_chars;
-        expr->values[1].as_expr = insts_to_expr(insts, i, end);
+        expr->values[0].as_chars = insts_symbol(arg);
+        expr->values[1].as_expr = insts_to_value(insts, i, end);
+        if (expr->values[1].as_expr == NULL) {
+            return NULL;
+        }
         expr->type = EXPR_STORE;
         return expr;
     }
     case INST_PUSH: {
-        Expr* expr = expr_alloc();
-        expr->values[0].as_i64 = inst.value.as_i64;
-        expr->type = EXPR_I64;
-        return expr;
+        Expr expr = {0};
+        expr.values[0].as_i64 = PROGRAM.consts[arg];
+        expr.values[1].as_i64 = 0;
+        expr.type = EXPR_I64;
+        return expr_cons(expr);
     }
     case INST_JMP: {
         Expr* expr = expr_alloc();
-        expr->values[0].as_chars = insts[inst.value.as_u32].value.as_chars;
+        expr->values[0].as_chars = insts_symbol(PROGRAM.args[arg]);
         expr->type = EXPR_JMP;
         return expr;
     }
     case INST_JZ: {
         Expr* expr = expr_alloc();
-        expr->values[0].as_chars = insts[inst.value.as_u32].value.as_chars;
-        expr->values[1].as_expr = insts_to_expr(insts, i, end);
+        expr->values[0].as_chars = insts_symbol(PROGRAM.args[arg]);
+        expr->values[1].as_expr = insts_to_value(insts, i, end);
+        if (expr->values[1].as_expr == NULL) {
+            return NULL;
+        }
         expr->type = EXPR_JZ;
         return expr;
     }
     case INST_LT: {
-        Expr* expr = expr_alloc();
-        expr->values[1].as_expr = insts_to_expr(insts, i, end);
-        expr->values[0].as_expr = insts_to_expr(insts, i, end);
-        expr->type = EXPR_LT;
-        return expr;
+        return insts_to_binary(insts, i, end, EXPR_LT);
     }
     case INST_EQ: {
-        Expr* expr = expr_alloc();
-        expr->values[1].as_expr = insts_to_expr(insts, i, end);
-        expr->values[0].as_expr = insts_to_expr(insts, i, end);
-        expr->type = EXPR_EQ;
-        return expr;
+        return insts_to_binary(insts, i, end, EXPR_EQ);
     }
     case INST_AND: {
-        Expr* expr = expr_alloc();
-        expr->values[1].as_expr = insts_to_expr(insts, i, end);
-        expr->values[0].as_expr = insts_to_expr(insts, i, end);
-        expr->type = EXPR_AND;
-        return expr;
+        return insts_to_binary(insts, i, end, EXPR_AND);
     }
     case INST_ADD: {
-        Expr* expr = expr_alloc();
-        expr->values[1].as_expr = insts_to_expr(insts, i, end);
-        expr->values[0].as_expr = insts_to_expr(insts, i, end);
-        expr->type = EXPR_ADD;
-        return expr;
+        return insts_to_binary(insts, i, end, EXPR_ADD);
+    }
+    case INST_HALT:
+    case INST_ALLOC:
+    case INST_PRINTLN_I64:
+    case INST_ADD_LOCAL_IMM:
+    case INST_JGE_LOCAL_IMM:
+    case INST_JNZ_TESTBIT_LOCAL:
+    default: {
+        return NULL;
     }
-    case INST_PRINTLN_I64: {
-        EXIT();
     }
-    default: {
-        EXIT();
+}
+
+static Expr* expr_label(const char* prefix, u32 n) {
+    char* label = ARENA_ALLOC(&ARENA_EXPRS, char, 24);
+    EXIT_IF(23 < snprintf(label, 24, "%s_%u", prefix, n));
+
+    Expr* expr = expr_alloc();
+    expr->values[0].as_chars = label;
+    expr->values[1].as_i64 = 0;
+    expr->type = EXPR_LABEL;
+    return expr;
+}
+
+static Expr* expr_exit(u32 inst) {
+    Expr* expr = expr_alloc();
+    expr->values[0].as_i64 = inst;
+    expr->type = EXPR_EXIT;
+    return expr;
+}
+
+static Expr* expr_jz(const Expr* label, Expr* condition) {
+    Expr* expr = expr_alloc();
+    expr->values[0].as_chars = label->values[0].as_chars;
+    expr->values[1].as_expr = condition;
+    expr->type = EXPR_JZ;
+    return expr;
+}
+
+// NOTE: Every instruction in the range yields at most one entry in `LIST`
+// and touches at most one local, so both are sized up front. Falling off the
+// end exits to its last instruction, the label after the back edge.
+u32 exprs_parse(u32 start, u32 end) {
+    EXIT_IF(end < start);
+
+    arena_reset(&ARENA_EXPRS);
+    LIST = ARENA_ALLOC(&ARENA_EXPRS, const Expr*, (end - start) + 1);
+    ESCAPES = ARENA_ALLOC(&ARENA_EXPRS, u32, PROGRAM.len_locals);
+    LEN_LIST = 0;
+    LEN_ESCAPES = 0;
+
+    u32* insts = ARENA_ALLOC(&ARENA_EXPRS, u32, end - start);
+    for (u32 i = start; i < end; ++i) {
+        insts[i - start] = i;
     }
+    conses_init(end - start);
+
+    list_push(expr_exit(end - 1));
+
+    for (u32 i = end - start; 0 < i;) {
+        const Expr* expr = insts_to_expr(insts, &i, 0);
+        if ((expr == NULL) || expr_is_value(expr)) {
+            return ERROR;
+        }
+        list_push(expr);
     }
+    return OK;
 }
 
-void exprs_parse(const Inst* insts, u32 start, u32 end) {
-    LEN_EXPRS = 0;
+// NOTE: Builds a straight-line loop from `insts`, the instructions one
+// recorded pass executed, in order; `next` is where that pass went after the
+// last of them. Labels and jumps disappear. Every `JZ` becomes a guard on the
+// direction it took, whose side exit returns the index of the instruction
+// the other direction leads to. If `next` is the first instruction the
+// trace loops, otherwise it exits to `next`.
+u32 exprs_trace(const u32* insts, u32 len, u32 next) {
+    EXIT_IF(len == 0);
+
+    arena_reset(&ARENA_EXPRS);
+    LIST = ARENA_ALLOC(&ARENA_EXPRS, const Expr*, (3 * len) + 2);
+    ESCAPES = ARENA_ALLOC(&ARENA_EXPRS, u32, PROGRAM.len_locals);
     LEN_LIST = 0;
     LEN_ESCAPES = 0;
+    conses_init(len);
 
-    {
+    // NOTE: Exits for guards that expect a non-zero condition are out of
+    // line, after the loop, so the recorded direction never branches.
+    for (u32 i = 0; i < len; ++i) {
+        const u32 inst = insts[i];
+        const u32 target = PROGRAM.args[inst];
+        const u32 taken = (i + 1) < len ? insts[i + 1] : next;
+        if ((PROGRAM.types[inst] == INST_JZ) && (taken != target)) {
+            list_push(expr_exit(target));
+            list_push(expr_label("exit", i));
+        }
+    }
+
+    const Expr* loop = expr_label("trace", insts[0]);
+    if (next == insts[0]) {
         Expr* expr = expr_alloc();
-        expr->type = EXPR_RET;
+        expr->values[0].as_chars = loop->values[0].as_chars;
+        expr->type = EXPR_JMP;
         list_push(expr);
+    } else {
+        list_push(expr_exit(next));
     }
 
-    for (u32 i = end; start < i;) {
-        list_push(insts_to_expr(insts, &i, start));
+    for (u32 i = len; i != 0;) {
+        const u32 inst = insts[i - 1];
+        switch ((InstType)PROGRAM.types[inst]) {
+        case INST_LABEL:
+        case INST_JMP: {
+            --i;
+            break;
+        }
+        case INST_JZ: {
+            const u32 position = --i;
+            const u32 target = PROGRAM.args[inst];
+            const u32 taken = (position + 1) < len ? insts[position + 1] : next;
+
+            Expr* condition = insts_to_value(insts, &i, 0);
+            if (condition == NULL) {
+                return ERROR;
+            }
+            if (target == (inst + 1)) {
+                break;
+            }
+            if (taken != target) {
+                list_push(expr_jz(expr_label("exit", position), condition));
+                break;
+            }
+            const Expr* label = expr_label("guard", position);
+            list_push(label);
+            list_push(expr_exit(inst + 1));
+            list_push(expr_jz(label, condition));
+            break;
+        }
+        case INST_HALT:
+        case INST_ALLOC:
+        case INST_LOAD:
+        case INST_STORE:
+        case INST_PUSH:
+        case INST_LT:
+        case INST_EQ:
+        case INST_AND:
+        case INST_ADD:
+        case INST_PRINTLN_I64:
+        case INST_ADD_LOCAL_IMM:
+        case INST_JGE_LOCAL_IMM:
+        case INST_JNZ_TESTBIT_LOCAL:
+        default: {
+            const Expr* expr = insts_to_expr(insts, &i, 0);
+            if ((expr == NULL) || expr_is_value(expr)) {
+                return ERROR;
+            }
+            list_push(expr);
+        }
+        }
     }
+
+    list_push(loop);
+    return OK;
 }
 
 void exprs_show(void) {
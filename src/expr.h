@@ -7,7 +7,7 @@ typedef enum {
     EXPR_IDENT = 0,
     EXPR_I64,
 
-    EXPR_RET,
+    EXPR_EXIT,
 
     EXPR_LABEL,
 
@@ -27,6 +27,8 @@ typedef enum {
 
 typedef struct Expr Expr;
 
+// NOTE: A label's second value is how many jumps to it the interpreter has
+// taken so far; `0` for one that `exprs_trace` makes up.
 struct Expr {
     union {
         const char* as_chars;
@@ -37,16 +39,15 @@ struct Expr {
     ExprType type;
 };
 
-void exprs_parse(const Inst*, u32, u32);
+u32  exprs_parse(u32, u32);
+u32  exprs_trace(const u32*, u32, u32);
 void exprs_show(void);
 
-#define CAP_ESCAPES (1 << 3)
-#define CAP_LIST    (1 << 4)
+// NOTE: The slot of every local the parsed range reads or writes.
+extern u32* ESCAPES;
+extern u32  LEN_ESCAPES;
 
-extern const char* ESCAPES[CAP_ESCAPES];
-extern u32         LEN_ESCAPES;
-
-extern const Expr* LIST[CAP_LIST];
-extern u32         LEN_LIST;
+extern const Expr** LIST;
+extern u32          LEN_LIST;
 
 #endif
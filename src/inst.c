@@ -1,122 +1,249 @@
 #include "asm.h"
+#include "cache.h"
+#include "table.h"
 
 typedef struct {
-    const char* key;
-    InstValue   value;
-} KeyValue;
+    u32 start;
+    u32 len;
+} Block;
+
+typedef enum {
+    TAC_HALT = 0,
+
+    TAC_MOV,
+
+    TAC_JMP,
+    TAC_JZ,
+    TAC_JGE,
+    TAC_JNE,
+
+    TAC_LT,
+    TAC_EQ,
+
+    TAC_AND,
+
+    TAC_ADD,
 
+    TAC_PRINTLN_I64,
+} TacType;
+
+// NOTE: Three-address code over frame slots. For jumps, `args[2]` is the
+// target `Inst`, which `TAC_OFFSETS` maps to a `Tac`; `args[1]` is the
+// condition of a `JZ`, and a `JGE` or `JNE` compares `args[0]` with
+// `args[1]`. `inst` is the originating `Inst` so the `JUMPS` profile stays
+// intact.
 typedef struct {
-    Inst* insts;
-    u32   len;
-} Block;
+    u32     args[3];
+    u32     inst;
+    TacType type;
+} Tac;
+
+// NOTE: Owns the encoded `PROGRAM`; reset by every `insts_encode`.
+static Arena ARENA_PROGRAM = {0};
+
+// NOTE: Owns everything `insts_prepare` derives from `PROGRAM`; reset by
+// every `insts_prepare`, so a loaded program never keeps an old one's tables.
+static Arena ARENA_INSTS = {0};
+
+Program PROGRAM = {0};
+
+u32* JUMPS = NULL;
+u32* LOOPS = NULL;
 
-#define CAP_STACK (1 << 3)
-static InstValue STACK[CAP_STACK];
-static u32       LEN_STACK = 0;
+Bool INSTS_SHOW = FALSE;
 
-#define CAP_LOCALS (1 << 3)
-static KeyValue LOCALS[CAP_LOCALS];
-static u32      LEN_LOCALS = 0;
+static u8*   TYPES = NULL;
+static u32*  ARGS = NULL;
+static i64*  CONSTS = NULL;
+static u32*  SYMBOLS = NULL;
+static char* CHARS = NULL;
 
-#define CAP_INST_LABELS (1 << 3)
-static KeyValue INST_LABELS[CAP_INST_LABELS];
-static u32      LEN_INST_LABELS = 0;
+// NOTE: Open-addressed index into `CONSTS`, so interning a constant probes a
+// slot or two instead of scanning the pool; at least twice as many slots as
+// `PUSH`es, a power of two, and `CONST_NONE` where empty.
+static u32* CONST_SLOTS = NULL;
+static u32  CAP_CONST_SLOTS = 0;
 
-#define CAP_BLOCKS (1 << 3)
-static Block BLOCKS[CAP_BLOCKS];
-static u32   LEN_BLOCKS = 0;
+#define CONST_NONE 0xFFFFFFFF
+
+STATIC_ASSERT(INST_JNZ_TESTBIT_LOCAL <= 0xFF);
+
+// NOTE: Sized by `insts_verify` to the deepest stack the program can reach.
+static InstValue* STACK = NULL;
+static u32        LEN_STACK = 0;
+static u32        CAP_STACK = 0;
+
+#define HEIGHT_UNKNOWN 0xFFFFFFFF
+static u32* HEIGHTS = NULL;
+
+// NOTE: Locals come first, then one temporary per stack slot, then a copy of
+// the constant pool.
+static i64* FRAME = NULL;
+static u32  FRAME_TEMPS = 0;
+static u32  FRAME_CONSTS = 0;
+
+static Tac*  TACS = NULL;
+static u32   LEN_TACS = 0;
+static u32*  TAC_OFFSETS = NULL;
+static Bool  TRANSLATED = FALSE;
+
+static u8* FUSED = NULL;
+
+// NOTE: Back-edge count at which a loop is compiled; `0` never compiles.
+#ifndef JIT_THRESHOLD
+    #define JIT_THRESHOLD 64
+#endif
+
+// NOTE: Compiled code, whole loop or trace, takes `FRAME` in `rdi`, reads
+// and writes local `n` at `[rdi + 8 * n]`, and returns in `eax` the
+// instruction to resume at. Both tiers share the one frame, so nothing is
+// copied in or out on either side of a call.
+typedef u32 (*Compiled)(i64*);
+
+// NOTE: Indexed by loop header; set once the loop closing on it is compiled.
+// `TRIED` marks every header either tier has been asked to compile, so a
+// loop goes through the compiler at most once, even when its counter wraps
+// back round to `JIT_THRESHOLD`. `LEN_COMPILED` is the length of the program
+// both were made for, so the next `insts_prepare` can release its code.
+static Compiled* COMPILED = NULL;
+static Bool*     TRIED = NULL;
+static u32       LEN_COMPILED = 0;
+
+// NOTE: Indexed by the instruction a trace starts at; `EXITS` counts how often
+// traces leave to each instruction, so a hot side exit can grow a trace of
+// its own. `RECORD` holds the trace being recorded.
+static Compiled* TRACES = NULL;
+static u32*      EXITS = NULL;
+static u32*      RECORD = NULL;
+
+typedef struct {
+    InstType types[6];
+    u32      len;
+    InstType fused;
+} Fusion;
 
-STATIC_ASSERT(CAP_INSTS <= 0xFFFFFFFF);
+static const Fusion FUSIONS[] = {
+    {
+        .types = {INST_LOAD, INST_PUSH, INST_ADD, INST_STORE},
+        .len = 4,
+        .fused = INST_ADD_LOCAL_IMM,
+    },
+    {
+        .types = {INST_LOAD, INST_PUSH, INST_LT, INST_JZ},
+        .len = 4,
+        .fused = INST_JGE_LOCAL_IMM,
+    },
+    {
+        .types = {INST_LOAD, INST_PUSH, INST_AND, INST_PUSH, INST_EQ, INST_JZ},
+        .len = 6,
+        .fused = INST_JNZ_TESTBIT_LOCAL,
+    },
+};
 
+#define LEN_FUSIONS (sizeof(FUSIONS) / sizeof(FUSIONS[0]))
+
+// NOTE: Both map a name to its index; a local to its slot and a label to its
+// instruction.
+static Table INST_LOCALS = {0};
+static Table INST_LABELS = {0};
+
+static Block* BLOCKS = NULL;
+static u32    LEN_BLOCKS = 0;
+
+// NOTE: Unchecked; `insts_verify` has already proven every push fits and
+// every pop has an operand.
 static void stack_push(InstValue value) {
-    EXIT_IF(CAP_STACK <= LEN_STACK);
     STACK[LEN_STACK++] = value;
 }
 
 static InstValue stack_pop(void) {
-    EXIT_IF(LEN_STACK == 0);
     return STACK[--LEN_STACK];
 }
 
-static void local_push(const char* key, InstValue value) {
-    EXIT_IF(CAP_LOCALS <= LEN_LOCALS);
-    LOCALS[LEN_LOCALS++] = (KeyValue){
-        .key = key,
-        .value = value,
-    };
+static u32 symbol_push(u32* len_symbols, const char* key) {
+    const u32 n = len(key) + 1;
+    SYMBOLS[*len_symbols] = PROGRAM.len_chars;
+    for (u32 i = 0; i < n; ++i) {
+        CHARS[PROGRAM.len_chars++] = key[i];
+    }
+    return (*len_symbols)++;
 }
 
-static KeyValue* local_find(const char* key) {
-    EXIT_IF(LEN_LOCALS == 0);
-    for (u32 i = LEN_LOCALS;;) {
-        KeyValue* local = &LOCALS[--i];
-        if (eq(key, local->key)) {
-            return local;
-        }
-        if (i == 0) {
-            EXIT();
-        }
-    }
+static u32 local_find(const char* key) {
+    const u32* slot = table_find(&INST_LOCALS, key);
+    EXIT_IF(slot == NULL);
+    return *slot;
 }
 
-static void inst_label_push(const char* key, InstValue value) {
-    EXIT_IF(CAP_INST_LABELS <= LEN_INST_LABELS);
-    INST_LABELS[LEN_INST_LABELS++] = (KeyValue){
-        .key = key,
-        .value = value,
-    };
+static u32 local_push(u32* len_locals, const char* key) {
+    EXIT_IF(!table_insert(&INST_LOCALS, key, *len_locals));
+    return symbol_push(len_locals, key);
 }
 
-static KeyValue* inst_label_find(const char* key) {
-    EXIT_IF(LEN_INST_LABELS == 0);
-    for (u32 i = LEN_INST_LABELS;;) {
-        KeyValue* label = &INST_LABELS[--i];
-        if (eq(key, label->key)) {
-            return label;
-        }
-        if (i == 0) {
-            EXIT();
+static u32 const_push(u32* len_consts, i64 value) {
+    const u32 mask = CAP_CONST_SLOTS - 1;
+    u32       k = hash_word(HASH_SEED, (u64)value) & mask;
+    for (; CONST_SLOTS[k] != CONST_NONE; k = (k + 1) & mask) {
+        if (CONSTS[CONST_SLOTS[k]] == value) {
+            return CONST_SLOTS[k];
         }
     }
+    CONST_SLOTS[k] = *len_consts;
+    CONSTS[*len_consts] = value;
+    return (*len_consts)++;
+}
+
+static void inst_label_push(const char* key, u32 inst) {
+    EXIT_IF(!table_insert(&INST_LABELS, key, inst));
+}
+
+static u32 inst_label_find(const char* key) {
+    const u32* inst = table_find(&INST_LABELS, key);
+    EXIT_IF(inst == NULL);
+    return *inst;
 }
 
 static Block* block_alloc(void) {
-    EXIT_IF(CAP_BLOCKS <= LEN_BLOCKS);
     return &BLOCKS[LEN_BLOCKS++];
 }
 
-static void inst_println(Inst inst) {
-    switch (inst.type) {
+const char* insts_symbol(u32 symbol) {
+    return &PROGRAM.chars[PROGRAM.symbols[symbol]];
+}
+
+static void inst_println(u32 i) {
+    const u32 arg = PROGRAM.args[i];
+    switch ((InstType)PROGRAM.types[i]) {
     case INST_HALT: {
         printf("        halt\n");
         break;
     }
     case INST_LABEL: {
-        printf("    %s:\n", inst.value.as_chars);
+        printf("    %s:\n", insts_symbol(arg));
         break;
     }
     case INST_ALLOC: {
-        printf("        alloc       %s\n", inst.value.as_chars);
+        printf("        alloc       %s\n", insts_symbol(arg));
         break;
     }
     case INST_LOAD: {
-        printf("        load        %s\n", inst.value.as_chars);
+        printf("        load        %s\n", insts_symbol(arg));
         break;
     }
     case INST_STORE: {
-        printf("        store       %s\n", inst.value.as_chars);
+        printf("        store       %s\n", insts_symbol(arg));
         break;
     }
     case INST_PUSH: {
-        printf("        push        %ld\n", inst.value.as_i64);
+        printf("        push        %ld\n", PROGRAM.consts[arg]);
         break;
     }
     case INST_JMP: {
-        printf("        jmp         %u\n", inst.value.as_u32);
+        printf("        jmp         %u\n", arg);
         break;
     }
     case INST_JZ: {
-        printf("        jz          %u\n", inst.value.as_u32);
+        printf("        jz          %u\n", arg);
         break;
     }
     case INST_LT: {
@@ -139,25 +266,419 @@ static void inst_println(Inst inst) {
         printf("        println_i64\n");
         break;
     }
+    case INST_ADD_LOCAL_IMM:
+    case INST_JGE_LOCAL_IMM:
+    case INST_JNZ_TESTBIT_LOCAL:
     default: {
         EXIT();
     }
     }
 }
 
-void insts_setup(Inst* insts, u32 len_insts) {
-    EXIT_IF(CAP_INSTS < len_insts);
+// NOTE: Locals are interned first so a local's slot doubles as its symbol;
+// labels, jump targets, and constants are resolved afterwards. No table can
+// outgrow the instruction count, so each is allocated once at that size.
+static void insts_encode(const Inst* insts, u32 len_insts) {
+    u32 len_symbols = 0;
+    u32 len_consts = 0;
+    u64 len_chars = 0;
+    u32 len_allocs = 0;
+    u32 len_labels = 0;
+    u32 len_pushes = 0;
+
+    for (u32 i = 0; i < len_insts; ++i) {
+        const Inst inst = insts[i];
+        if (inst.type == INST_ALLOC) {
+            len_chars += len(inst.value.as_chars) + 1;
+            ++len_allocs;
+        } else if (inst.type == INST_LABEL) {
+            len_chars += len(inst.value.as_chars) + 1;
+            ++len_labels;
+        } else if (inst.type == INST_PUSH) {
+            ++len_pushes;
+        }
+    }
+    EXIT_IF(0xFFFFFFFF < len_chars);
+
+    CAP_CONST_SLOTS = 1;
+    for (; CAP_CONST_SLOTS < (len_pushes * 2lu); CAP_CONST_SLOTS <<= 1) {
+        EXIT_IF((1u << 31) <= CAP_CONST_SLOTS);
+    }
+
+    arena_reset(&ARENA_PROGRAM);
+    TYPES = ARENA_ALLOC(&ARENA_PROGRAM, u8, len_insts);
+    ARGS = ARENA_ALLOC(&ARENA_PROGRAM, u32, len_insts);
+    CONSTS = ARENA_ALLOC(&ARENA_PROGRAM, i64, len_insts);
+    SYMBOLS = ARENA_ALLOC(&ARENA_PROGRAM, u32, len_insts);
+    CHARS = ARENA_ALLOC(&ARENA_PROGRAM, char, len_chars);
+    CONST_SLOTS = ARENA_ALLOC(&ARENA_PROGRAM, u32, CAP_CONST_SLOTS);
+    for (u32 i = 0; i < CAP_CONST_SLOTS; ++i) {
+        CONST_SLOTS[i] = CONST_NONE;
+    }
+    table_init(&INST_LOCALS, &ARENA_PROGRAM, len_allocs);
+    table_init(&INST_LABELS, &ARENA_PROGRAM, len_labels);
+
+    PROGRAM.len_chars = 0;
+    for (u32 i = 0; i < len_insts; ++i) {
+        const Inst inst = insts[i];
+        TYPES[i] = (u8)inst.type;
+        ARGS[i] = 0;
+        if (inst.type == INST_ALLOC) {
+            ARGS[i] = local_push(&len_symbols, inst.value.as_chars);
+        } else if ((inst.type == INST_LOAD) || (inst.type == INST_STORE)) {
+            ARGS[i] = local_find(inst.value.as_chars);
+        }
+    }
+    const u32 len_locals = len_symbols;
+
+    for (u32 i = 0; i < len_insts; ++i) {
+        const Inst inst = insts[i];
+        if (inst.type == INST_LABEL) {
+            ARGS[i] = symbol_push(&len_symbols, inst.value.as_chars);
+            inst_label_push(inst.value.as_chars, i);
+        }
+    }
+
+    for (u32 i = 0; i < len_insts; ++i) {
+        const Inst inst = insts[i];
+        if ((inst.type == INST_JMP) || (inst.type == INST_JZ)) {
+            ARGS[i] = inst_label_find(inst.value.as_chars);
+        } else if (inst.type == INST_PUSH) {
+            ARGS[i] = const_push(&len_consts, inst.value.as_i64);
+        }
+    }
+
+    PROGRAM.types = TYPES;
+    PROGRAM.args = ARGS;
+    PROGRAM.consts = CONSTS;
+    PROGRAM.symbols = SYMBOLS;
+    PROGRAM.chars = CHARS;
+    PROGRAM.len = len_insts;
+    PROGRAM.len_consts = len_consts;
+    PROGRAM.len_symbols = len_symbols;
+    PROGRAM.len_locals = len_locals;
+}
+
+static Bool insts_match(u32 i, Fusion fusion) {
+    if ((PROGRAM.len - i) < fusion.len) {
+        return FALSE;
+    }
+    for (u32 j = 0; j < fusion.len; ++j) {
+        if (PROGRAM.types[i + j] != fusion.types[j]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// NOTE: Superinstructions keep their operands in the original instructions;
+// only the dispatch type of the first instruction in each idiom is rewritten,
+// so `insts_show` and jump targets are unaffected. They serve the stack
+// interpreter, which runs whenever `insts_translate` gives up; the TAC tier
+// fuses the same idioms into `TAC_ADD`, `TAC_JGE` and `TAC_JNE` itself.
+static void insts_fuse(void) {
+    for (u32 i = 0; i < PROGRAM.len; ++i) {
+        FUSED[i] = PROGRAM.types[i];
+    }
+
+    for (u32 i = 0; i < PROGRAM.len;) {
+        u32 j = 0;
+        for (; j < LEN_FUSIONS; ++j) {
+            if (insts_match(i, FUSIONS[j])) {
+                break;
+            }
+        }
+        if (j == LEN_FUSIONS) {
+            ++i;
+            continue;
+        }
+        FUSED[i] = (u8)FUSIONS[j].fused;
+        i += FUSIONS[j].len;
+    }
+}
+
+static void tac_push(TacType type, u32 inst, u32 arg0, u32 arg1, u32 arg2) {
+    TACS[LEN_TACS++] = (Tac){
+        .args = {arg0, arg1, arg2},
+        .inst = inst,
+        .type = type,
+    };
+}
+
+// NOTE: Stack slot `n` is pinned to frame slot `FRAME_TEMPS + n`; loads and
+// pushes stay symbolic until an operator consumes them. Anything that keeps
+// values on the stack across a label or jump is left to the stack
+// interpreter.
+static u32 insts_translate(void) {
+    u32* stack = ARENA_ALLOC(&ARENA_INSTS, u32, CAP_STACK);
+    u32  len_stack = 0;
+
+    for (u32 i = 0; i < PROGRAM.len_consts; ++i) {
+        FRAME[FRAME_CONSTS + i] = PROGRAM.consts[i];
+    }
 
-    for (u32 i = 0; i < len_insts;) {
+    LEN_TACS = 0;
+    for (u32 i = 0; i < PROGRAM.len; ++i) {
+        const u32 arg = PROGRAM.args[i];
+        TAC_OFFSETS[i] = LEN_TACS;
+        switch ((InstType)PROGRAM.types[i]) {
+        case INST_HALT: {
+            tac_push(TAC_HALT, i, 0, 0, 0);
+            break;
+        }
+        case INST_LABEL: {
+            if (len_stack != 0) {
+                return ERROR;
+            }
+            break;
+        }
+        case INST_ALLOC:
+        case INST_STORE: {
+            if (len_stack == 0) {
+                return ERROR;
+            }
+            const u32 value = stack[--len_stack];
+            for (u32 j = 0; j < len_stack; ++j) {
+                if (stack[j] == arg) {
+                    stack[j] = FRAME_TEMPS + j;
+                    tac_push(TAC_MOV, i, stack[j], arg, 0);
+                }
+            }
+            Tac* last = LEN_TACS == 0 ? NULL : &TACS[LEN_TACS - 1];
+            if ((value == (FRAME_TEMPS + len_stack)) && (last != NULL) &&
+                (last->args[0] == value) &&
+                ((last->type == TAC_LT) || (last->type == TAC_EQ) ||
+                 (last->type == TAC_AND) || (last->type == TAC_ADD)))
+            {
+                last->args[0] = arg;
+            } else {
+                tac_push(TAC_MOV, i, arg, value, 0);
+            }
+            break;
+        }
+        case INST_LOAD: {
+            if (CAP_STACK <= len_stack) {
+                return ERROR;
+            }
+            stack[len_stack++] = arg;
+            break;
+        }
+        case INST_PUSH: {
+            if (CAP_STACK <= len_stack) {
+                return ERROR;
+            }
+            stack[len_stack++] = FRAME_CONSTS + arg;
+            break;
+        }
+        case INST_JMP: {
+            if (len_stack != 0) {
+                return ERROR;
+            }
+            tac_push(TAC_JMP, i, 0, 0, arg);
+            break;
+        }
+        case INST_JZ: {
+            if (len_stack != 1) {
+                return ERROR;
+            }
+            const u32 cond = stack[--len_stack];
+            Tac*      last = LEN_TACS == 0 ? NULL : &TACS[LEN_TACS - 1];
+            if ((cond == FRAME_TEMPS) && (last != NULL) &&
+                (last->args[0] == cond) &&
+                ((last->type == TAC_LT) || (last->type == TAC_EQ)))
+            {
+                // NOTE: `jz(lt(l, r))` jumps when `l >= r`, and `jz(eq(l, r))`
+                // when `l != r`; the comparison it tests becomes the jump.
+                *last = (Tac){
+                    .args = {last->args[1], last->args[2], arg},
+                    .inst = i,
+                    .type = last->type == TAC_LT ? TAC_JGE : TAC_JNE,
+                };
+            } else {
+                tac_push(TAC_JZ, i, 0, cond, arg);
+            }
+            break;
+        }
+        case INST_LT:
+        case INST_EQ:
+        case INST_AND:
+        case INST_ADD: {
+            if (len_stack < 2) {
+                return ERROR;
+            }
+            const u32 r = stack[--len_stack];
+            const u32 l = stack[--len_stack];
+
+            const InstType inst_type = (InstType)PROGRAM.types[i];
+            const TacType  type = inst_type == INST_LT    ? TAC_LT
+                                  : inst_type == INST_EQ  ? TAC_EQ
+                                  : inst_type == INST_AND ? TAC_AND
+                                                          : TAC_ADD;
+            tac_push(type, i, FRAME_TEMPS + len_stack, l, r);
+            stack[len_stack] = FRAME_TEMPS + len_stack;
+            ++len_stack;
+            break;
+        }
+        case INST_PRINTLN_I64: {
+            if (len_stack == 0) {
+                return ERROR;
+            }
+            tac_push(TAC_PRINTLN_I64, i, stack[--len_stack], 0, 0);
+            break;
+        }
+        case INST_ADD_LOCAL_IMM:
+        case INST_JGE_LOCAL_IMM:
+        case INST_JNZ_TESTBIT_LOCAL:
+        default: {
+            return ERROR;
+        }
+        }
+    }
+    return OK;
+}
+
+static void inst_effect(InstType type, u32* pops, u32* pushes) {
+    *pops = 0;
+    *pushes = 0;
+    switch (type) {
+    case INST_HALT:
+    case INST_LABEL:
+    case INST_JMP: {
+        break;
+    }
+    case INST_ALLOC:
+    case INST_STORE:
+    case INST_JZ:
+    case INST_PRINTLN_I64: {
+        *pops = 1;
+        break;
+    }
+    case INST_LOAD:
+    case INST_PUSH: {
+        *pushes = 1;
+        break;
+    }
+    case INST_LT:
+    case INST_EQ:
+    case INST_AND:
+    case INST_ADD: {
+        *pops = 2;
+        *pushes = 1;
+        break;
+    }
+    case INST_ADD_LOCAL_IMM:
+    case INST_JGE_LOCAL_IMM:
+    case INST_JNZ_TESTBIT_LOCAL:
+    default: {
+        EXIT();
+    }
+    }
+}
+
+static void height_join(u32* work, u32* len_work, u32 i, u32 height) {
+    if (HEIGHTS[i] == HEIGHT_UNKNOWN) {
+        HEIGHTS[i] = height;
+        work[(*len_work)++] = i;
+        return;
+    }
+    EXIT_IF(HEIGHTS[i] != height);
+}
+
+// NOTE: Abstract interpretation over the block graph; proves the stack height
+// before every reachable instruction and returns the deepest one.
+static u32 insts_verify(void) {
+    u32* work = ARENA_ALLOC(&ARENA_INSTS, u32, PROGRAM.len);
+    u32 len_work = 0;
+    u32 max = 0;
+
+    for (u32 i = 0; i < PROGRAM.len; ++i) {
+        HEIGHTS[i] = HEIGHT_UNKNOWN;
+    }
+    height_join(work, &len_work, 0, 0);
+
+    while (len_work != 0) {
+        u32 i = work[--len_work];
+        u32 height = HEIGHTS[i];
+        for (;;) {
+            const InstType type = (InstType)PROGRAM.types[i];
+            HEIGHTS[i] = height;
+
+            u32 pops;
+            u32 pushes;
+            inst_effect(type, &pops, &pushes);
+            EXIT_IF(height < pops);
+            height = (height - pops) + pushes;
+            if (max < height) {
+                max = height;
+            }
+
+            if (type == INST_HALT) {
+                break;
+            }
+            if ((type == INST_JMP) || (type == INST_JZ)) {
+                height_join(work, &len_work, PROGRAM.args[i], height);
+                if (type == INST_JMP) {
+                    break;
+                }
+            }
+
+            ++i;
+            EXIT_IF(PROGRAM.len <= i);
+            if (PROGRAM.types[i] == INST_LABEL) {
+                height_join(work, &len_work, i, height);
+                break;
+            }
+        }
+    }
+
+    return max;
+}
+
+// NOTE: Everything that runs once `PROGRAM` is populated, whether by
+// `insts_encode` or by mapping a bytecode file.
+void insts_prepare(void) {
+    for (u32 i = 0; i < LEN_COMPILED; ++i) {
+        if (COMPILED[i] != NULL) {
+            asm_free((void*)COMPILED[i]);
+        }
+        if (TRACES[i] != NULL) {
+            asm_free((void*)TRACES[i]);
+        }
+    }
+    LEN_COMPILED = PROGRAM.len;
+
+    arena_reset(&ARENA_INSTS);
+    BLOCKS = ARENA_ALLOC(&ARENA_INSTS, Block, PROGRAM.len);
+    HEIGHTS = ARENA_ALLOC(&ARENA_INSTS, u32, PROGRAM.len);
+    FUSED = ARENA_ALLOC(&ARENA_INSTS, u8, PROGRAM.len);
+    TAC_OFFSETS = ARENA_ALLOC(&ARENA_INSTS, u32, PROGRAM.len);
+    JUMPS = ARENA_ALLOC(&ARENA_INSTS, u32, PROGRAM.len);
+    LOOPS = ARENA_ALLOC(&ARENA_INSTS, u32, PROGRAM.len);
+    COMPILED = ARENA_ALLOC(&ARENA_INSTS, Compiled, PROGRAM.len);
+    TRIED = ARENA_ALLOC(&ARENA_INSTS, Bool, PROGRAM.len);
+    TRACES = ARENA_ALLOC(&ARENA_INSTS, Compiled, PROGRAM.len);
+    EXITS = ARENA_ALLOC(&ARENA_INSTS, u32, PROGRAM.len);
+    RECORD = ARENA_ALLOC(&ARENA_INSTS, u32, PROGRAM.len);
+    for (u32 i = 0; i < PROGRAM.len; ++i) {
+        JUMPS[i] = 0;
+        LOOPS[i] = 0;
+        COMPILED[i] = NULL;
+        TRIED[i] = FALSE;
+        TRACES[i] = NULL;
+        EXITS[i] = 0;
+    }
+
+    LEN_BLOCKS = 0;
+    for (u32 i = 0; i < PROGRAM.len;) {
         Block* block = block_alloc();
-        block->insts = &insts[i];
+        block->start = i;
         u32 j = i + 1;
-        for (; j < len_insts; ++j) {
-            const Inst inst = insts[j];
-            if (inst.type == INST_LABEL) {
+        for (; j < PROGRAM.len; ++j) {
+            const InstType type = (InstType)PROGRAM.types[j];
+            if (type == INST_LABEL) {
                 break;
             }
-            if ((inst.type == INST_JMP) || (inst.type == INST_JZ)) {
+            if ((type == INST_JMP) || (type == INST_JZ)) {
                 ++j;
                 break;
             }
@@ -166,78 +687,587 @@ void insts_setup(Inst* insts, u32 len_insts) {
         i = j;
     }
 
-    for (u32 i = 0; i < len_insts; ++i) {
-        const Inst inst = insts[i];
-        if (inst.type == INST_LABEL) {
-            inst_label_push(inst.value.as_chars, (InstValue){.as_u32 = i});
+    CAP_STACK = insts_verify();
+    STACK = ARENA_ALLOC(&ARENA_INSTS, InstValue, CAP_STACK);
+    LEN_STACK = 0;
+
+    // NOTE: A `STORE` emits at most one `MOV` per value left beneath it on
+    // the stack, plus its own, so no instruction expands past this.
+    TACS = ARENA_ALLOC(&ARENA_INSTS, Tac, (u64)PROGRAM.len * (CAP_STACK + 1));
+
+    FRAME_TEMPS = PROGRAM.len_locals;
+    FRAME_CONSTS = FRAME_TEMPS + CAP_STACK;
+    FRAME = ARENA_ALLOC(&ARENA_INSTS, i64, FRAME_CONSTS + PROGRAM.len_consts);
+
+    insts_fuse();
+    TRANSLATED = insts_translate() == OK;
+}
+
+void insts_setup(const Inst* insts, u32 len_insts) {
+    insts_encode(insts, len_insts);
+    insts_prepare();
+}
+
+// NOTE: The compiled loop returns through the label right after its back
+// edge, which is where interpretation resumes, so the stack must be empty at
+// both ends. A loop an earlier run left in the cache skips the compiler.
+// With `INSTS_SHOW` set, each stage is dumped as the loop goes through it.
+static void inst_compile(u32 from, u32 to) {
+    const u32 end = from + 2;
+    if ((PROGRAM.len < end) || (PROGRAM.types[from + 1] != INST_LABEL) ||
+        (HEIGHTS[to] != 0) || (HEIGHTS[from + 1] != 0))
+    {
+        return;
+    }
+    COMPILED[to] = (Compiled)cache_load(to, end);
+    if (INSTS_SHOW) {
+        printf("\n%u -> %u%s\n",
+               to,
+               end,
+               (COMPILED[to] != NULL) ? " cached" : "");
+    }
+    if (COMPILED[to] != NULL) {
+        return;
+    }
+    if (exprs_parse(to, end) != OK) {
+        return;
+    }
+    if (INSTS_SHOW) {
+        exprs_show();
+    }
+    if (ir_build() != OK) {
+        return;
+    }
+    ir_optimize();
+    if (INSTS_SHOW) {
+        ir_show();
+    }
+    if (asm_emit() != OK) {
+        return;
+    }
+    if (INSTS_SHOW) {
+        asm_show();
+    }
+    COMPILED[to] = (Compiled)asm_jit();
+    cache_store(to, end);
+}
+
+// NOTE: A statement starts and ends on an empty stack. Recording one must
+// not print or allocate, and any jump in it must leave the stack empty, so
+// that every exit from a trace can resume in either interpreter.
+static Bool statement_traceable(u32 i) {
+    for (u32 height = 0;; ++i) {
+        const InstType type = (InstType)PROGRAM.types[i];
+        if ((type == INST_HALT) || (type == INST_ALLOC) ||
+            (type == INST_PRINTLN_I64))
+        {
+            return FALSE;
+        }
+        u32 pops;
+        u32 pushes;
+        inst_effect(type, &pops, &pushes);
+        height = (height - pops) + pushes;
+        if ((type == INST_JMP) || (type == INST_JZ)) {
+            return height == 0;
+        }
+        if (height == 0) {
+            return TRUE;
         }
     }
+}
 
-    for (u32 i = 0; i < len_insts; ++i) {
-        const Inst inst = insts[i];
-        if ((inst.type == INST_JMP) || (inst.type == INST_JZ)) {
-            insts[i].value = inst_label_find(inst.value.as_chars)->value;
+// NOTE: Interprets a single instruction, bumping the profile on any jump it
+// takes, and returns the next one.
+static u32 inst_step(u32 i) {
+    const u32 arg = PROGRAM.args[i];
+    switch ((InstType)PROGRAM.types[i]) {
+    case INST_LABEL: {
+        break;
+    }
+    case INST_STORE: {
+        FRAME[arg] = stack_pop().as_i64;
+        break;
+    }
+    case INST_LOAD: {
+        stack_push((InstValue){.as_i64 = FRAME[arg]});
+        break;
+    }
+    case INST_PUSH: {
+        stack_push((InstValue){.as_i64 = PROGRAM.consts[arg]});
+        break;
+    }
+    case INST_JMP: {
+        ++JUMPS[arg];
+        return arg;
+    }
+    case INST_JZ: {
+        if (stack_pop().as_u64 == 0) {
+            ++JUMPS[arg];
+            return arg;
+        }
+        break;
+    }
+    case INST_LT: {
+        const i64 r = stack_pop().as_i64;
+        const i64 l = stack_pop().as_i64;
+        stack_push((InstValue){.as_u64 = l < r});
+        break;
+    }
+    case INST_EQ: {
+        const u64 r = stack_pop().as_u64;
+        const u64 l = stack_pop().as_u64;
+        stack_push((InstValue){.as_u64 = l == r});
+        break;
+    }
+    case INST_AND: {
+        const u64 r = stack_pop().as_u64;
+        const u64 l = stack_pop().as_u64;
+        stack_push((InstValue){.as_u64 = l & r});
+        break;
+    }
+    case INST_ADD: {
+        const i64 r = stack_pop().as_i64;
+        const i64 l = stack_pop().as_i64;
+        stack_push((InstValue){.as_i64 = l + r});
+        break;
+    }
+    case INST_HALT:
+    case INST_ALLOC:
+    case INST_PRINTLN_I64:
+    case INST_ADD_LOCAL_IMM:
+    case INST_JGE_LOCAL_IMM:
+    case INST_JNZ_TESTBIT_LOCAL:
+    default: {
+        EXIT();
+    }
+    }
+    return i + 1;
+}
+
+// NOTE: Records the path one pass takes from `start`, a statement boundary,
+// executing it along the way. Recording gives up on anything untraceable and
+// on a back edge to anywhere but `anchor`, the loop header; reaching `anchor`
+// compiles the trace. Forward progress bounds a recording by the program
+// length. Returns the instruction to resume at.
+static u32 trace_grow(u32 start, u32 anchor) {
+    u32 len = 0;
+    u32 i = start;
+    for (;;) {
+        if (!statement_traceable(i)) {
+            return i;
+        }
+        u32 last;
+        do {
+            RECORD[len++] = i;
+            last = i;
+            i = inst_step(i);
+        } while (LEN_STACK != 0);
+        if (i == anchor) {
+            break;
+        }
+        if (i <= last) {
+            return i;
         }
     }
+    if ((exprs_trace(RECORD, len, anchor) != OK) || (ir_build() != OK)) {
+        return i;
+    }
+    ir_optimize();
+    if (asm_emit() == OK) {
+        TRACES[start] = (Compiled)asm_jit();
+    }
+    return i;
 }
 
-void insts_run(const Inst* insts) {
+// NOTE: Chains traces until one leaves to an instruction with none; a side
+// exit taken often enough grows a bridge trace back to `anchor`.
+static u32 traces_run(u32 anchor) {
+    u32 i = anchor;
+    for (;;) {
+        while (TRACES[i] != NULL) {
+            i = TRACES[i](FRAME);
+        }
+        if ((HEIGHTS[i] != 0) || (++EXITS[i] != JIT_THRESHOLD)) {
+            return i;
+        }
+        i = trace_grow(i, anchor);
+        if (i != anchor) {
+            return i;
+        }
+    }
+}
+
+// NOTE: Returns the next instruction to interpret. A back edge into a
+// compiled loop runs the rest of the loop in place on `FRAME` and resumes
+// after the back edge. A loop the whole-loop compiler rejects, say for a
+// `println` off the hot path, is recorded as a trace instead.
+static u32 inst_jump(u32 from, u32 to) {
+    ++JUMPS[to];
+    if (to < from) {
+        if (LOOPS[to] == 0) {
+            LOOPS[to] = from;
+        } else {
+            EXIT_IF(LOOPS[to] != from);
+        }
+        if ((JUMPS[to] == JIT_THRESHOLD) && !TRIED[to]) {
+            TRIED[to] = TRUE;
+            inst_compile(from, to);
+            if ((COMPILED[to] == NULL) && (HEIGHTS[to] == 0)) {
+                const u32 next = trace_grow(to, to);
+                if (next != to) {
+                    return next;
+                }
+            }
+        }
+        if (COMPILED[to] != NULL) {
+            return COMPILED[to](FRAME);
+        }
+        if (TRACES[to] != NULL) {
+            return traces_run(to);
+        }
+    }
+    return to;
+}
+
+#ifdef THREADED
+
+    #define DISPATCH()                \
+        do {                          \
+            tac = TACS[i];            \
+            goto *HANDLERS[tac.type]; \
+        } while (FALSE)
+
+static void tacs_run(void) {
+    static const void* const HANDLERS[] = {
+        [TAC_HALT] = &&tac_halt,
+        [TAC_MOV] = &&tac_mov,
+        [TAC_JMP] = &&tac_jmp,
+        [TAC_JZ] = &&tac_jz,
+        [TAC_JGE] = &&tac_jge,
+        [TAC_JNE] = &&tac_jne,
+        [TAC_LT] = &&tac_lt,
+        [TAC_EQ] = &&tac_eq,
+        [TAC_AND] = &&tac_and,
+        [TAC_ADD] = &&tac_add,
+        [TAC_PRINTLN_I64] = &&tac_println_i64,
+    };
+
+    u32 i = 0;
+    Tac tac;
+    DISPATCH();
+
+tac_halt: {
+    return;
+}
+tac_mov: {
+    FRAME[tac.args[0]] = FRAME[tac.args[1]];
+    ++i;
+    DISPATCH();
+}
+tac_jmp: {
+    i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+    DISPATCH();
+}
+tac_jz: {
+    if (FRAME[tac.args[1]] == 0) {
+        i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+    } else {
+        ++i;
+    }
+    DISPATCH();
+}
+tac_jge: {
+    if (FRAME[tac.args[1]] <= FRAME[tac.args[0]]) {
+        i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+    } else {
+        ++i;
+    }
+    DISPATCH();
+}
+tac_jne: {
+    if (FRAME[tac.args[0]] != FRAME[tac.args[1]]) {
+        i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+    } else {
+        ++i;
+    }
+    DISPATCH();
+}
+tac_lt: {
+    FRAME[tac.args[0]] = FRAME[tac.args[1]] < FRAME[tac.args[2]];
+    ++i;
+    DISPATCH();
+}
+tac_eq: {
+    FRAME[tac.args[0]] = FRAME[tac.args[1]] == FRAME[tac.args[2]];
+    ++i;
+    DISPATCH();
+}
+tac_and: {
+    FRAME[tac.args[0]] = FRAME[tac.args[1]] & FRAME[tac.args[2]];
+    ++i;
+    DISPATCH();
+}
+tac_add: {
+    FRAME[tac.args[0]] = FRAME[tac.args[1]] + FRAME[tac.args[2]];
+    ++i;
+    DISPATCH();
+}
+tac_println_i64: {
+    printf("%lu\n", FRAME[tac.args[0]]);
+    ++i;
+    DISPATCH();
+}
+}
+
+    #undef DISPATCH
+
+    #define DISPATCH() goto *HANDLERS[FUSED[i]]
+
+// NOTE: Direct-threaded dispatch; every handler ends in its own indirect
+// branch, so the predictor sees one branch per opcode rather than one shared
+// branch for the whole loop.
+void insts_run(void) {
+    static const void* const HANDLERS[] = {
+        [INST_HALT] = &&inst_halt,
+        [INST_LABEL] = &&inst_label,
+        [INST_ALLOC] = &&inst_store,
+        [INST_LOAD] = &&inst_load,
+        [INST_STORE] = &&inst_store,
+        [INST_PUSH] = &&inst_push,
+        [INST_JMP] = &&inst_jmp,
+        [INST_JZ] = &&inst_jz,
+        [INST_LT] = &&inst_lt,
+        [INST_EQ] = &&inst_eq,
+        [INST_AND] = &&inst_and,
+        [INST_ADD] = &&inst_add,
+        [INST_PRINTLN_I64] = &&inst_println_i64,
+        [INST_ADD_LOCAL_IMM] = &&inst_add_local_imm,
+        [INST_JGE_LOCAL_IMM] = &&inst_jge_local_imm,
+        [INST_JNZ_TESTBIT_LOCAL] = &&inst_jnz_testbit_local,
+    };
+
+    if (TRANSLATED) {
+        tacs_run();
+        return;
+    }
+
+    LEN_STACK = 0;
+
+    const u32* args = PROGRAM.args;
+    const i64* consts = PROGRAM.consts;
+    u32        i = 0;
+    DISPATCH();
+
+inst_halt: {
+    return;
+}
+inst_label: {
+    ++i;
+    DISPATCH();
+}
+inst_store: {
+    FRAME[args[i]] = stack_pop().as_i64;
+    ++i;
+    DISPATCH();
+}
+inst_load: {
+    stack_push((InstValue){.as_i64 = FRAME[args[i]]});
+    ++i;
+    DISPATCH();
+}
+inst_push: {
+    stack_push((InstValue){.as_i64 = consts[args[i]]});
+    ++i;
+    DISPATCH();
+}
+inst_jmp: {
+    i = inst_jump(i, args[i]);
+    DISPATCH();
+}
+inst_jz: {
+    if (stack_pop().as_u64 == 0) {
+        i = inst_jump(i, args[i]);
+    } else {
+        ++i;
+    }
+    DISPATCH();
+}
+inst_lt: {
+    const i64 r = stack_pop().as_i64;
+    const i64 l = stack_pop().as_i64;
+    stack_push((InstValue){.as_u64 = l < r});
+    ++i;
+    DISPATCH();
+}
+inst_eq: {
+    const u64 r = stack_pop().as_u64;
+    const u64 l = stack_pop().as_u64;
+    stack_push((InstValue){.as_u64 = l == r});
+    ++i;
+    DISPATCH();
+}
+inst_and: {
+    const u64 r = stack_pop().as_u64;
+    const u64 l = stack_pop().as_u64;
+    stack_push((InstValue){.as_u64 = l & r});
+    ++i;
+    DISPATCH();
+}
+inst_add: {
+    const i64 r = stack_pop().as_i64;
+    const i64 l = stack_pop().as_i64;
+    stack_push((InstValue){.as_i64 = l + r});
+    ++i;
+    DISPATCH();
+}
+inst_println_i64: {
+    printf("%lu\n", stack_pop().as_i64);
+    ++i;
+    DISPATCH();
+}
+inst_add_local_imm: {
+    FRAME[args[i + 3]] = FRAME[args[i]] + consts[args[i + 1]];
+    i += 4;
+    DISPATCH();
+}
+inst_jge_local_imm: {
+    if (consts[args[i + 1]] <= FRAME[args[i]]) {
+        i = inst_jump(i + 3, args[i + 3]);
+    } else {
+        i += 4;
+    }
+    DISPATCH();
+}
+inst_jnz_testbit_local: {
+    if ((FRAME[args[i]] & consts[args[i + 1]]) != consts[args[i + 3]]) {
+        i = inst_jump(i + 5, args[i + 5]);
+    } else {
+        i += 6;
+    }
+    DISPATCH();
+}
+}
+
+    #undef DISPATCH
+
+#else
+
+static void tacs_run(void) {
     u32 i = 0;
     for (;;) {
-        const Inst inst = insts[i];
-        switch (inst.type) {
-        case INST_HALT: {
+        const Tac tac = TACS[i];
+        switch (tac.type) {
+        case TAC_HALT: {
             return;
         }
-        case INST_LABEL: {
+        case TAC_MOV: {
+            FRAME[tac.args[0]] = FRAME[tac.args[1]];
             ++i;
             break;
         }
-        case INST_ALLOC: {
-            local_push(inst.value.as_chars, stack_pop());
+        case TAC_JMP: {
+            i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+            break;
+        }
+        case TAC_JZ: {
+            if (FRAME[tac.args[1]] == 0) {
+                i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+            } else {
+                ++i;
+            }
+            break;
+        }
+        case TAC_JGE: {
+            if (FRAME[tac.args[1]] <= FRAME[tac.args[0]]) {
+                i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+            } else {
+                ++i;
+            }
+            break;
+        }
+        case TAC_JNE: {
+            if (FRAME[tac.args[0]] != FRAME[tac.args[1]]) {
+                i = TAC_OFFSETS[inst_jump(tac.inst, tac.args[2])];
+            } else {
+                ++i;
+            }
+            break;
+        }
+        case TAC_LT: {
+            FRAME[tac.args[0]] = FRAME[tac.args[1]] < FRAME[tac.args[2]];
             ++i;
             break;
         }
-        case INST_LOAD: {
-            const KeyValue* local = local_find(inst.value.as_chars);
-            stack_push(local->value);
+        case TAC_EQ: {
+            FRAME[tac.args[0]] = FRAME[tac.args[1]] == FRAME[tac.args[2]];
+            ++i;
+            break;
+        }
+        case TAC_AND: {
+            FRAME[tac.args[0]] = FRAME[tac.args[1]] & FRAME[tac.args[2]];
+            ++i;
+            break;
+        }
+        case TAC_ADD: {
+            FRAME[tac.args[0]] = FRAME[tac.args[1]] + FRAME[tac.args[2]];
+            ++i;
+            break;
+        }
+        case TAC_PRINTLN_I64: {
+            printf("%lu\n", FRAME[tac.args[0]]);
+            ++i;
+            break;
+        }
+        default: {
+            EXIT();
+        }
+        }
+    }
+}
+
+void insts_run(void) {
+    if (TRANSLATED) {
+        tacs_run();
+        return;
+    }
+
+    LEN_STACK = 0;
+
+    const u32* args = PROGRAM.args;
+    const i64* consts = PROGRAM.consts;
+    u32        i = 0;
+    for (;;) {
+        switch ((InstType)FUSED[i]) {
+        case INST_HALT: {
+            return;
+        }
+        case INST_LABEL: {
             ++i;
             break;
         }
+        case INST_ALLOC:
         case INST_STORE: {
-            KeyValue* local = local_find(inst.value.as_chars);
-            local->value = stack_pop();
+            FRAME[args[i]] = stack_pop().as_i64;
+            ++i;
+            break;
+        }
+        case INST_LOAD: {
+            stack_push((InstValue){.as_i64 = FRAME[args[i]]});
             ++i;
             break;
         }
         case INST_PUSH: {
-            stack_push(inst.value);
+            stack_push((InstValue){.as_i64 = consts[args[i]]});
             ++i;
             break;
         }
         case INST_JMP: {
-            ++JUMPS[inst.value.as_u32];
-            if (inst.value.as_u32 < i) {
-                if (LOOPS[inst.value.as_u32] == 0) {
-                    LOOPS[inst.value.as_u32] = i;
-                } else {
-                    EXIT_IF(LOOPS[inst.value.as_u32] != i);
-                }
-            }
-            i = inst.value.as_u32;
+            i = inst_jump(i, args[i]);
             break;
         }
         case INST_JZ: {
             if (stack_pop().as_u64 == 0) {
-                ++JUMPS[inst.value.as_u32];
-                if (inst.value.as_u32 < i) {
-                    if (LOOPS[inst.value.as_u32] == 0) {
-                        LOOPS[inst.value.as_u32] = i;
-                    } else {
-                        EXIT_IF(LOOPS[inst.value.as_u32] != i);
-                    }
-                }
-                i = inst.value.as_u32;
+                i = inst_jump(i, args[i]);
             } else {
                 ++i;
             }
@@ -276,6 +1306,28 @@ void insts_run(const Inst* insts) {
             ++i;
             break;
         }
+        case INST_ADD_LOCAL_IMM: {
+            FRAME[args[i + 3]] = FRAME[args[i]] + consts[args[i + 1]];
+            i += 4;
+            break;
+        }
+        case INST_JGE_LOCAL_IMM: {
+            if (consts[args[i + 1]] <= FRAME[args[i]]) {
+                i = inst_jump(i + 3, args[i + 3]);
+            } else {
+                i += 4;
+            }
+            break;
+        }
+        case INST_JNZ_TESTBIT_LOCAL: {
+            if ((FRAME[args[i]] & consts[args[i + 1]]) != consts[args[i + 3]])
+            {
+                i = inst_jump(i + 5, args[i + 5]);
+            } else {
+                i += 6;
+            }
+            break;
+        }
         default: {
             EXIT();
         }
@@ -283,6 +1335,8 @@ void insts_run(const Inst* insts) {
     }
 }
 
+#endif
+
 void insts_show(void) {
     u32 l = 0;
     for (u32 i = 0; i < LEN_BLOCKS; ++i) {
@@ -296,7 +1350,7 @@ void insts_show(void) {
             } else {
                 printf("       |");
             }
-            inst_println(block.insts[j]);
+            inst_println(block.start + j);
         }
     }
 }
@@ -25,6 +25,12 @@ typedef enum {
     INST_ADD,
 
     INST_PRINTLN_I64,
+
+    // NOTE: Superinstructions; only ever produced by `insts_fuse`, for the
+    // stack interpreter.
+    INST_ADD_LOCAL_IMM,
+    INST_JGE_LOCAL_IMM,
+    INST_JNZ_TESTBIT_LOCAL,
 } InstType;
 
 typedef union {
@@ -36,18 +42,43 @@ typedef union {
 
 STATIC_ASSERT(sizeof(InstValue) == sizeof(i64));
 
+// NOTE: Source form; labels and locals are still named.
 typedef struct {
     InstValue value;
     InstType  type;
 } Inst;
 
-void insts_setup(Inst*, u32);
-void insts_run(const Inst*);
-void insts_show(void);
-
-#define CAP_INSTS (1 << 5)
-
-extern u32 JUMPS[CAP_INSTS];
-extern u32 LOOPS[CAP_INSTS];
+// NOTE: Compact form built by `insts_setup`. `args` holds a local slot for
+// `ALLOC`, `LOAD`, and `STORE`, an index into `consts` for `PUSH`, a target
+// instruction for `JMP` and `JZ`, and a symbol for `LABEL`. Symbols are
+// offsets into `chars`; the first `len_locals` of them name the locals, so a
+// slot is also its own symbol.
+typedef struct {
+    const u8*   types;
+    const u32*  args;
+    const i64*  consts;
+    const u32*  symbols;
+    const char* chars;
+    u32         len;
+    u32         len_consts;
+    u32         len_symbols;
+    u32         len_locals;
+    u32         len_chars;
+} Program;
+
+void        insts_setup(const Inst*, u32);
+void        insts_prepare(void);
+void        insts_run(void);
+void        insts_show(void);
+const char* insts_symbol(u32);
+
+// NOTE: One counter per instruction, allocated by `insts_prepare`.
+extern u32* JUMPS;
+extern u32* LOOPS;
+
+extern Program PROGRAM;
+
+// NOTE: Dumps every loop `insts_run` compiles, stage by stage, as it goes.
+extern Bool INSTS_SHOW;
 
 #endif
@@ -0,0 +1,2212 @@
+#include "ir.h"
+#include "table.h"
+
+#define IR_NONE 0xFFFFFFFF
+
+// NOTE: `IR_VALUES` grows one `value_alloc` at a time, and `IR_BLOCKS` and
+// `SOURCES` one `block_alloc` at a time, so each gets an arena of its own
+// and stays contiguous; everything else comes out of `ARENA_IR`. All are
+// reset by every `ir_build`.
+static Arena ARENA_IR_VALUES = {0};
+static Arena ARENA_IR_BLOCKS = {0};
+static Arena ARENA_IR_SOURCES = {0};
+static Arena ARENA_IR = {0};
+
+IrBlock* IR_BLOCKS = NULL;
+u32      LEN_IR_BLOCKS = 0;
+
+// NOTE: How many blocks `ARENA_IR_BLOCKS` and `ARENA_IR_SOURCES` hold.
+// `ir_build` drops its last block without handing the slot back, so the next
+// `block_alloc` reuses it.
+static u32 CAP_IR_BLOCKS = 0;
+
+IrValue* IR_VALUES = NULL;
+u32      LEN_IR_VALUES = 0;
+
+// NOTE: Map a label to its block and a local to its index in `ESCAPES`.
+static Table IR_LABELS = {0};
+static Table IR_LOCALS = {0};
+
+// NOTE: Indexed by block; what `ir_build` renames into values, the label a
+// jump names, and how many jumps the interpreter took to the block's labels.
+typedef struct {
+    const Expr** stmts;
+    const Expr*  cond;
+    const char*  target;
+    u32          len_stmts;
+    u32          jumps;
+} Source;
+
+static Source* SOURCES = NULL;
+
+// NOTE: What an operator `Expr` was renamed into, by block. `exprs_parse`
+// shares the nodes for a computation repeated between stores, so one met
+// again in the same block is computed once.
+typedef struct {
+    const Expr* expr;
+    u32         block;
+    u32         value;
+} Memo;
+
+static Memo* MEMOS = NULL;
+static u32   CAP_MEMOS = 0;
+
+// NOTE: Reachable blocks in reverse postorder, and the position of each in
+// it. `ENTER` and `LEAVE` number the dominator tree depth first, so `a`
+// dominates `b` exactly when the span of `b` nests in that of `a`.
+static u32* RPO = NULL;
+static u32  LEN_RPO = 0;
+static u32* ORDER = NULL;
+static u32* ENTER = NULL;
+static u32* LEAVE = NULL;
+
+// NOTE: Indexed by value; what a pass has replaced it with, if anything.
+static u32* FORWARD = NULL;
+
+static IrBlock* block_alloc(void) {
+    if (LEN_IR_BLOCKS == CAP_IR_BLOCKS) {
+        ARENA_ALLOC(&ARENA_IR_SOURCES, Source, 1);
+        ARENA_ALLOC(&ARENA_IR_BLOCKS, IrBlock, 1);
+        ++CAP_IR_BLOCKS;
+    }
+    Source* source = &SOURCES[LEN_IR_BLOCKS];
+    *source = (Source){0};
+    IrBlock* block = &IR_BLOCKS[LEN_IR_BLOCKS++];
+    *block = (IrBlock){0};
+    block->cond = IR_NONE;
+    return block;
+}
+
+static u32 value_alloc(IrOp op, u32 block, u32 len_args) {
+    IrValue* value = ARENA_ALLOC(&ARENA_IR_VALUES, IrValue, 1);
+    *value = (IrValue){0};
+    value->args = ARENA_ALLOC(&ARENA_IR, u32, len_args);
+    value->block = block;
+    value->op = op;
+    IrBlock* owner = &IR_BLOCKS[block];
+    owner->values[owner->len_values++] = LEN_IR_VALUES;
+    return LEN_IR_VALUES++;
+}
+
+u32 ir_len_args(const IrValue* value) {
+    switch (value->op) {
+    case IR_PHI: {
+        return IR_BLOCKS[value->block].len_preds;
+    }
+    case IR_LT:
+    case IR_EQ:
+    case IR_AND:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_SHR: {
+        return 2;
+    }
+    case IR_SELECT: {
+        return 3;
+    }
+    case IR_CONST:
+    case IR_PARAM:
+    default: {
+        return 0;
+    }
+    }
+}
+
+u32 ir_len_succs(const IrBlock* block) {
+    switch (block->term) {
+    case IR_JMP: {
+        return 1;
+    }
+    case IR_JZ: {
+        return 2;
+    }
+    case IR_EXIT:
+    default: {
+        return 0;
+    }
+    }
+}
+
+static Bool block_dominates(u32 a, u32 b) {
+    return (ENTER[a] <= ENTER[b]) && (LEAVE[b] <= LEAVE[a]);
+}
+
+// NOTE: Drops predecessor `j` of `block`, along with what each phi takes
+// from it.
+static void block_pred_remove(IrBlock* block, u32 j) {
+    for (u32 i = 0; i < block->len_values; ++i) {
+        IrValue* value = &IR_VALUES[block->values[i]];
+        if (value->op != IR_PHI) {
+            continue;
+        }
+        for (u32 k = j + 1; k < block->len_preds; ++k) {
+            value->args[k - 1] = value->args[k];
+        }
+    }
+    for (u32 k = j + 1; k < block->len_preds; ++k) {
+        block->preds[k - 1] = block->preds[k];
+    }
+    --block->len_preds;
+}
+
+static u32 blocks_intersect(u32 a, u32 b) {
+    while (a != b) {
+        while (ORDER[b] < ORDER[a]) {
+            a = IR_BLOCKS[a].idom;
+        }
+        while (ORDER[a] < ORDER[b]) {
+            b = IR_BLOCKS[b].idom;
+        }
+    }
+    return a;
+}
+
+// NOTE: Finds what block `0` reaches and unlinks the rest, then rebuilds
+// `RPO` and the dominator tree; see Cooper, Harvey and Kennedy, "A Simple,
+// Fast Dominance Algorithm". Run again whenever a pass drops an edge.
+static void blocks_order(void) {
+    u32* stack = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    u32* cursors = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    u32  len_stack = 0;
+    RPO = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    ORDER = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    ENTER = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    LEAVE = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        IR_BLOCKS[i].reachable = FALSE;
+        IR_BLOCKS[i].idom = IR_NONE;
+        cursors[i] = 0;
+    }
+    IR_BLOCKS[0].reachable = TRUE;
+    stack[len_stack++] = 0;
+    LEN_RPO = LEN_IR_BLOCKS;
+    while (len_stack != 0) {
+        const u32      b = stack[len_stack - 1];
+        const IrBlock* block = &IR_BLOCKS[b];
+        if (cursors[b] < ir_len_succs(block)) {
+            IrBlock* succ = &IR_BLOCKS[block->succs[cursors[b]++]];
+            if (!succ->reachable) {
+                succ->reachable = TRUE;
+                stack[len_stack++] = block->succs[cursors[b] - 1];
+            }
+            continue;
+        }
+        RPO[--LEN_RPO] = b;
+        --len_stack;
+    }
+    const u32 skipped = LEN_RPO;
+    LEN_RPO = LEN_IR_BLOCKS - skipped;
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        RPO[i] = RPO[i + skipped];
+        ORDER[RPO[i]] = i;
+    }
+
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        IrBlock* block = &IR_BLOCKS[RPO[i]];
+        for (u32 j = block->len_preds; j != 0;) {
+            if (!IR_BLOCKS[block->preds[--j]].reachable) {
+                block_pred_remove(block, j);
+            }
+        }
+    }
+
+    IR_BLOCKS[0].idom = 0;
+    for (Bool changed = TRUE; changed;) {
+        changed = FALSE;
+        for (u32 i = 1; i < LEN_RPO; ++i) {
+            IrBlock* block = &IR_BLOCKS[RPO[i]];
+            u32      idom = IR_NONE;
+            for (u32 j = 0; j < block->len_preds; ++j) {
+                const u32 pred = block->preds[j];
+                if (IR_BLOCKS[pred].idom == IR_NONE) {
+                    continue;
+                }
+                idom = idom == IR_NONE ? pred : blocks_intersect(pred, idom);
+            }
+            if (block->idom != idom) {
+                block->idom = idom;
+                changed = TRUE;
+            }
+        }
+    }
+
+    // NOTE: Children are threaded through `stack`, reused as the next sibling
+    // of each block, and `cursors`, as the first child.
+    u32* siblings = stack;
+    u32* children = cursors;
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        children[i] = IR_NONE;
+    }
+    for (u32 i = LEN_RPO; 1 < i;) {
+        const u32 b = RPO[--i];
+        if (IR_BLOCKS[b].idom == IR_NONE) {
+            continue;
+        }
+        siblings[b] = children[IR_BLOCKS[b].idom];
+        children[IR_BLOCKS[b].idom] = b;
+    }
+    u32* path = ARENA_ALLOC(&ARENA_IR, u32, LEN_RPO);
+    u32  len_path = 0;
+    u32  counter = 0;
+    ENTER[0] = counter++;
+    path[len_path++] = 0;
+    while (len_path != 0) {
+        const u32 b = path[len_path - 1];
+        const u32 child = children[b];
+        if (child == IR_NONE) {
+            LEAVE[b] = counter++;
+            --len_path;
+            continue;
+        }
+        children[b] = siblings[child];
+        ENTER[child] = counter++;
+        path[len_path++] = child;
+    }
+}
+
+// NOTE: The Sethi-Ullman number of `expr`: how many registers evaluating it
+// ties up at its peak. A binary operator's left operand always ends up in a
+// register; its right one can stay an immediate.
+static u32 expr_regs(const Expr* expr) {
+    switch (expr->type) {
+    case EXPR_I64: {
+        const i64 value = expr->values[0].as_i64;
+        return (-2147483648 <= value) && (value <= 2147483647) ? 0 : 1;
+    }
+    case EXPR_LT:
+    case EXPR_EQ:
+    case EXPR_AND:
+    case EXPR_ADD: {
+        u32       left = expr_regs(expr->values[0].as_expr);
+        const u32 right = expr_regs(expr->values[1].as_expr);
+        left = left == 0 ? 1 : left;
+        if (left == right) {
+            return left + 1;
+        }
+        return left < right ? right : left;
+    }
+    case EXPR_IDENT:
+    case EXPR_EXIT:
+    case EXPR_LABEL:
+    case EXPR_LOAD:
+    case EXPR_STORE:
+    case EXPR_JMP:
+    case EXPR_JZ:
+    default: {
+        return 0;
+    }
+    }
+}
+
+static u32 expr_nodes(const Expr* expr) {
+    switch (expr->type) {
+    case EXPR_STORE: {
+        return expr_nodes(expr->values[1].as_expr);
+    }
+    case EXPR_LT:
+    case EXPR_EQ:
+    case EXPR_AND:
+    case EXPR_ADD: {
+        return 1 + expr_nodes(expr->values[0].as_expr) +
+               expr_nodes(expr->values[1].as_expr);
+    }
+    case EXPR_IDENT:
+    case EXPR_I64:
+    case EXPR_EXIT:
+    case EXPR_LABEL:
+    case EXPR_LOAD:
+    case EXPR_JMP:
+    case EXPR_JZ:
+    default: {
+        return 1;
+    }
+    }
+}
+
+static IrOp expr_op(ExprType type) {
+    switch (type) {
+    case EXPR_LT: {
+        return IR_LT;
+    }
+    case EXPR_EQ: {
+        return IR_EQ;
+    }
+    case EXPR_AND: {
+        return IR_AND;
+    }
+    case EXPR_ADD: {
+        return IR_ADD;
+    }
+    case EXPR_IDENT:
+    case EXPR_I64:
+    case EXPR_EXIT:
+    case EXPR_LABEL:
+    case EXPR_LOAD:
+    case EXPR_STORE:
+    case EXPR_JMP:
+    case EXPR_JZ:
+    default: {
+        EXIT();
+    }
+    }
+}
+
+static u32 local_find(const char* key, u32* local) {
+    const u32* index = table_find(&IR_LOCALS, key);
+    if (index == NULL) {
+        return ERROR;
+    }
+    *local = *index;
+    return OK;
+}
+
+static Memo* memo_slot(const Expr* expr, u32 block) {
+    const u32 hash = hash_word(hash_word(HASH_SEED, (u64)expr), block);
+    u32       k = hash & (CAP_MEMOS - 1);
+    for (; MEMOS[k].expr != NULL; k = (k + 1) & (CAP_MEMOS - 1)) {
+        if ((MEMOS[k].expr == expr) && (MEMOS[k].block == block)) {
+            break;
+        }
+    }
+    return &MEMOS[k];
+}
+
+// NOTE: `defs` holds the current value of every local. Constants all go in
+// the entry block; one is never computed, so where it sits only matters to
+// `ir_gvn`, which can then merge every copy of it.
+static u32 expr_to_value(const Expr* expr, u32 block, u32* defs, u32* value) {
+    switch (expr->type) {
+    case EXPR_I64: {
+        *value = value_alloc(IR_CONST, 0, 0);
+        IR_VALUES[*value].imm = expr->values[0].as_i64;
+        return OK;
+    }
+    case EXPR_LOAD: {
+        u32 local = 0;
+        if (local_find(expr->values[0].as_chars, &local) != OK) {
+            return ERROR;
+        }
+        *value = defs[local];
+        return OK;
+    }
+    case EXPR_LT:
+    case EXPR_EQ:
+    case EXPR_AND:
+    case EXPR_ADD: {
+        const Memo* memo = memo_slot(expr, block);
+        if (memo->expr != NULL) {
+            *value = memo->value;
+            return OK;
+        }
+        const Expr* left_expr = expr->values[0].as_expr;
+        const Expr* right_expr = expr->values[1].as_expr;
+        u32         left = 0;
+        u32         right = 0;
+        if (expr_regs(left_expr) < expr_regs(right_expr)) {
+            if ((expr_to_value(right_expr, block, defs, &right) != OK) ||
+                (expr_to_value(left_expr, block, defs, &left) != OK))
+            {
+                return ERROR;
+            }
+        } else if ((expr_to_value(left_expr, block, defs, &left) != OK) ||
+                   (expr_to_value(right_expr, block, defs, &right) != OK))
+        {
+            return ERROR;
+        }
+        *value = value_alloc(expr_op(expr->type), block, 2);
+        IR_VALUES[*value].args[0] = left;
+        IR_VALUES[*value].args[1] = right;
+        *memo_slot(expr, block) =
+            (Memo){.expr = expr, .block = block, .value = *value};
+        return OK;
+    }
+    case EXPR_IDENT:
+    case EXPR_EXIT:
+    case EXPR_LABEL:
+    case EXPR_STORE:
+    case EXPR_JMP:
+    case EXPR_JZ:
+    default: {
+        return ERROR;
+    }
+    }
+}
+
+// NOTE: Ends the last block, which goes on to the next one unless `term`
+// says otherwise, and opens that next one.
+static void block_close(IrTerm term) {
+    IrBlock* block = &IR_BLOCKS[LEN_IR_BLOCKS - 1];
+    block->term = term;
+    block->succs[0] = LEN_IR_BLOCKS;
+    block_alloc();
+}
+
+// NOTE: A label starts a block of its own, unless the open one has nothing
+// in it yet. Jumps end one, and so does an exit; whatever follows either is
+// unreachable until the next label.
+static u32 blocks_split(void) {
+    const Expr** stmts = ARENA_ALLOC(&ARENA_IR, const Expr*, LEN_LIST);
+    u32          len_stmts = 0;
+
+    block_alloc();
+    block_close(IR_JMP);
+    SOURCES[1].stmts = stmts;
+
+    for (u32 i = LEN_LIST; i != 0;) {
+        const Expr* expr = LIST[--i];
+        IrBlock*    block = &IR_BLOCKS[LEN_IR_BLOCKS - 1];
+        Source*     source = &SOURCES[LEN_IR_BLOCKS - 1];
+        switch (expr->type) {
+        case EXPR_LABEL: {
+            if (source->len_stmts != 0) {
+                block_close(IR_JMP);
+                block = &IR_BLOCKS[LEN_IR_BLOCKS - 1];
+                SOURCES[LEN_IR_BLOCKS - 1].stmts = &stmts[len_stmts];
+            }
+            if (!table_insert(&IR_LABELS,
+                              expr->values[0].as_chars,
+                              LEN_IR_BLOCKS - 1))
+            {
+                return ERROR;
+            }
+            if (block->label == NULL) {
+                block->label = expr->values[0].as_chars;
+            }
+            SOURCES[LEN_IR_BLOCKS - 1].jumps += (u32)expr->values[1].as_i64;
+            break;
+        }
+        case EXPR_STORE: {
+            stmts[len_stmts++] = expr;
+            ++source->len_stmts;
+            break;
+        }
+        case EXPR_JMP: {
+            source->target = expr->values[0].as_chars;
+            block_close(IR_JMP);
+            SOURCES[LEN_IR_BLOCKS - 1].stmts = &stmts[len_stmts];
+            break;
+        }
+        case EXPR_JZ: {
+            source->target = expr->values[0].as_chars;
+            source->cond = expr->values[1].as_expr;
+            block_close(IR_JZ);
+            SOURCES[LEN_IR_BLOCKS - 1].stmts = &stmts[len_stmts];
+            break;
+        }
+        case EXPR_EXIT: {
+            const i64 inst = expr->values[0].as_i64;
+            if ((inst < 0) || (0x7FFFFFFF < inst)) {
+                return ERROR;
+            }
+            block->exit = (u32)inst;
+            block_close(IR_EXIT);
+            SOURCES[LEN_IR_BLOCKS - 1].stmts = &stmts[len_stmts];
+            break;
+        }
+        case EXPR_IDENT:
+        case EXPR_I64:
+        case EXPR_LOAD:
+        case EXPR_LT:
+        case EXPR_EQ:
+        case EXPR_AND:
+        case EXPR_ADD:
+        default: {
+            return ERROR;
+        }
+        }
+    }
+
+    // NOTE: Falling off the end is only fine from somewhere unreachable.
+    const IrBlock* last = &IR_BLOCKS[LEN_IR_BLOCKS - 1];
+    if ((last->label != NULL) || (SOURCES[LEN_IR_BLOCKS - 1].len_stmts != 0) ||
+        (IR_BLOCKS[LEN_IR_BLOCKS - 2].term == IR_JZ))
+    {
+        return ERROR;
+    }
+    --LEN_IR_BLOCKS;
+
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        const char* target = SOURCES[i].target;
+        if (target == NULL) {
+            continue;
+        }
+        const u32* b = table_find(&IR_LABELS, target);
+        if (b == NULL) {
+            return ERROR;
+        }
+        IR_BLOCKS[i].succs[IR_BLOCKS[i].term == IR_JZ ? 1 : 0] = *b;
+    }
+    return OK;
+}
+
+// NOTE: How many jumps the interpreter took to the block labelled `name`.
+static u32 label_jumps(const char* name) {
+    const u32* b = name == NULL ? NULL : table_find(&IR_LABELS, name);
+    return b == NULL ? 0 : SOURCES[*b].jumps;
+}
+
+// NOTE: Fills in `runs` while the blocks are still in program order. A block
+// runs once for every jump to one of its labels, and once for every time
+// the one before it falls into it; a branch falls through as often as it ran
+// and did not jump.
+static void blocks_profile(void) {
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        u64 runs = SOURCES[i].jumps;
+        if (i != 0) {
+            const IrBlock* prev = &IR_BLOCKS[i - 1];
+            const Source*  source = &SOURCES[i - 1];
+            if (prev->term == IR_JZ) {
+                const u32 taken = label_jumps(source->target);
+                runs += taken < prev->runs ? prev->runs - taken : 0;
+            } else if ((prev->term == IR_JMP) && (source->target == NULL)) {
+                runs += prev->runs;
+            }
+        }
+        IR_BLOCKS[i].runs = runs < 0xFFFFFFFF ? (u32)runs : 0xFFFFFFFF;
+    }
+}
+
+// NOTE: Puts an empty block on every edge from a block with two successors
+// to one with several predecessors, then fills in `preds`.
+static void blocks_link(void) {
+    u32* counts = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS * 3);
+    for (u32 i = 0; i < (LEN_IR_BLOCKS * 3); ++i) {
+        counts[i] = 0;
+    }
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        const IrBlock* block = &IR_BLOCKS[i];
+        for (u32 j = 0; block->reachable && (j < ir_len_succs(block)); ++j) {
+            ++counts[block->succs[j]];
+        }
+    }
+    for (u32 i = 0, len = LEN_IR_BLOCKS; i < len; ++i) {
+        if (!IR_BLOCKS[i].reachable || (IR_BLOCKS[i].term != IR_JZ)) {
+            continue;
+        }
+        for (u32 j = 0; j < 2; ++j) {
+            if (counts[IR_BLOCKS[i].succs[j]] < 2) {
+                continue;
+            }
+            IrBlock* edge = block_alloc();
+            edge->succs[0] = IR_BLOCKS[i].succs[j];
+            edge->term = IR_JMP;
+            edge->reachable = TRUE;
+            IR_BLOCKS[i].succs[j] = LEN_IR_BLOCKS - 1;
+            counts[LEN_IR_BLOCKS - 1] = 1;
+        }
+    }
+
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        IR_BLOCKS[i].preds = ARENA_ALLOC(&ARENA_IR, u32, counts[i]);
+        IR_BLOCKS[i].len_preds = 0;
+    }
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        const IrBlock* block = &IR_BLOCKS[i];
+        for (u32 j = 0; block->reachable && (j < ir_len_succs(block)); ++j) {
+            IrBlock* succ = &IR_BLOCKS[block->succs[j]];
+            succ->preds[succ->len_preds++] = i;
+        }
+    }
+}
+
+// NOTE: Places a phi for every local wherever two of its definitions meet,
+// at the iterated dominance frontier of the blocks that store to it; see
+// Cytron et al., "Efficiently Computing Static Single Assignment Form".
+// With `counts` it only counts them, per block.
+static void phis_place(const u32* frontiers,
+                       const u32* starts,
+                       u32*       counts) {
+    u32* placed = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    u32* queued = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    u32* work = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        placed[i] = IR_NONE;
+        queued[i] = IR_NONE;
+    }
+
+    for (u32 local = 0; local < LEN_ESCAPES; ++local) {
+        u32 len_work = 0;
+        for (u32 i = 0; i < LEN_RPO; ++i) {
+            const Source* source = &SOURCES[RPO[i]];
+            for (u32 j = 0; j < source->len_stmts; ++j) {
+                u32 stored = 0;
+                EXIT_IF(local_find(source->stmts[j]->values[0].as_chars,
+                                   &stored) != OK);
+                if ((stored == local) && (queued[RPO[i]] != local)) {
+                    queued[RPO[i]] = local;
+                    work[len_work++] = RPO[i];
+                }
+            }
+        }
+        while (len_work != 0) {
+            const u32 b = work[--len_work];
+            for (u32 i = starts[b]; i < starts[b + 1]; ++i) {
+                const u32 frontier = frontiers[i];
+                if (placed[frontier] == local) {
+                    continue;
+                }
+                placed[frontier] = local;
+                if (counts != NULL) {
+                    ++counts[frontier];
+                } else {
+                    IR_VALUES[value_alloc(IR_PHI,
+                                          frontier,
+                                          IR_BLOCKS[frontier].len_preds)]
+                        .local = local;
+                }
+                if (queued[frontier] != local) {
+                    queued[frontier] = local;
+                    work[len_work++] = frontier;
+                }
+            }
+        }
+    }
+}
+
+// NOTE: The dominance frontier of every block, flattened: those of `b` run
+// from `starts[b]` to `starts[b + 1]`. A block lands in the frontier of each
+// block on the way up the dominator tree from one of its predecessors to its
+// immediate dominator.
+static u32* blocks_frontiers(u32** starts) {
+    u32* counts = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS + 1);
+    u32* last = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    for (u32 i = 0; i <= LEN_IR_BLOCKS; ++i) {
+        counts[i] = 0;
+    }
+
+    u32* frontiers = NULL;
+    for (u32 pass = 0; pass < 2; ++pass) {
+        for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+            last[i] = IR_NONE;
+        }
+        for (u32 i = 0; i < LEN_RPO; ++i) {
+            const u32      b = RPO[i];
+            const IrBlock* block = &IR_BLOCKS[b];
+            if (block->len_preds < 2) {
+                continue;
+            }
+            for (u32 j = 0; j < block->len_preds; ++j) {
+                for (u32 runner = block->preds[j]; runner != block->idom;
+                     runner = IR_BLOCKS[runner].idom)
+                {
+                    if (last[runner] == b) {
+                        break;
+                    }
+                    last[runner] = b;
+                    if (pass == 0) {
+                        ++counts[runner + 1];
+                    } else {
+                        frontiers[counts[runner]++] = b;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+                counts[i + 1] += counts[i];
+            }
+            frontiers = ARENA_ALLOC(&ARENA_IR, u32, counts[LEN_IR_BLOCKS]);
+            *starts = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS + 1);
+            for (u32 i = 0; i <= LEN_IR_BLOCKS; ++i) {
+                (*starts)[i] = counts[i];
+            }
+        }
+    }
+    return frontiers;
+}
+
+// NOTE: Walks the blocks in reverse postorder, so each one starts from the
+// locals its immediate dominator ended with, overridden by its own phis.
+// Phi operands are filled in once every block has its `outs`.
+static u32 blocks_rename(const u32* params) {
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        const u32     b = RPO[i];
+        IrBlock*      block = &IR_BLOCKS[b];
+        const Source* source = &SOURCES[b];
+        u32*          defs = ARENA_ALLOC(&ARENA_IR, u32, LEN_ESCAPES);
+        const u32* from = b == 0 ? params : IR_BLOCKS[block->idom].outs;
+        for (u32 j = 0; j < LEN_ESCAPES; ++j) {
+            defs[j] = from[j];
+        }
+        for (u32 j = 0; j < block->len_values; ++j) {
+            const IrValue* value = &IR_VALUES[block->values[j]];
+            if (value->op == IR_PHI) {
+                defs[value->local] = block->values[j];
+            }
+        }
+        for (u32 j = 0; j < source->len_stmts; ++j) {
+            const Expr* stmt = source->stmts[j];
+            u32         local = 0;
+            const Expr* expr = stmt->values[1].as_expr;
+            if ((local_find(stmt->values[0].as_chars, &local) != OK) ||
+                (expr_to_value(expr, b, defs, &defs[local]) != OK))
+            {
+                return ERROR;
+            }
+        }
+        if ((block->term == IR_JZ) &&
+            (expr_to_value(source->cond, b, defs, &block->cond) != OK))
+        {
+            return ERROR;
+        }
+        block->outs = defs;
+    }
+
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        const IrBlock* block = &IR_BLOCKS[RPO[i]];
+        for (u32 j = 0; j < block->len_values; ++j) {
+            IrValue* value = &IR_VALUES[block->values[j]];
+            if (value->op != IR_PHI) {
+                continue;
+            }
+            for (u32 k = 0; k < block->len_preds; ++k) {
+                value->args[k] =
+                    IR_BLOCKS[block->preds[k]].outs[value->local];
+            }
+        }
+    }
+    return OK;
+}
+
+// NOTE: Turns `LIST` into a control flow graph of SSA values. Blocks break
+// where `insts_setup` breaks them, at labels and after jumps. Returns
+// `ERROR`, rather than exiting, for anything it cannot express.
+u32 ir_build(void) {
+    arena_reset(&ARENA_IR_VALUES);
+    arena_reset(&ARENA_IR_BLOCKS);
+    arena_reset(&ARENA_IR_SOURCES);
+    arena_reset(&ARENA_IR);
+    IR_BLOCKS = ARENA_ALLOC(&ARENA_IR_BLOCKS, IrBlock, 0);
+    SOURCES = ARENA_ALLOC(&ARENA_IR_SOURCES, Source, 0);
+    IR_VALUES = ARENA_ALLOC(&ARENA_IR_VALUES, IrValue, 0);
+    LEN_IR_BLOCKS = 0;
+    CAP_IR_BLOCKS = 0;
+    LEN_IR_VALUES = 0;
+    table_init(&IR_LABELS, &ARENA_IR, 0);
+    table_init(&IR_LOCALS, &ARENA_IR, LEN_ESCAPES);
+    for (u32 i = 0; i < LEN_ESCAPES; ++i) {
+        EXIT_IF(!table_insert(&IR_LOCALS, insts_symbol(ESCAPES[i]), i));
+    }
+
+    if (blocks_split() != OK) {
+        return ERROR;
+    }
+    blocks_profile();
+    blocks_order();
+    blocks_link();
+    blocks_order();
+
+    u32*       starts = NULL;
+    const u32* frontiers = blocks_frontiers(&starts);
+    u32*       counts = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        counts[i] = 0;
+    }
+    phis_place(frontiers, starts, counts);
+
+    u32 len_nodes = 0;
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        const Source* source = &SOURCES[i];
+        u32           len = counts[i];
+        for (u32 j = 0; j < source->len_stmts; ++j) {
+            len += expr_nodes(source->stmts[j]);
+        }
+        if (source->cond != NULL) {
+            len += expr_nodes(source->cond);
+        }
+        IR_BLOCKS[i].values = ARENA_ALLOC(&ARENA_IR, u32, len);
+        IR_BLOCKS[i].len_values = 0;
+        len_nodes += len;
+    }
+    IR_BLOCKS[0].values =
+        ARENA_ALLOC(&ARENA_IR, u32, LEN_ESCAPES + len_nodes);
+    CAP_MEMOS = 1 << 3;
+    while (CAP_MEMOS < (2 * (u64)len_nodes)) {
+        CAP_MEMOS <<= 1;
+    }
+    MEMOS = ARENA_ALLOC(&ARENA_IR, Memo, CAP_MEMOS);
+    for (u32 i = 0; i < CAP_MEMOS; ++i) {
+        MEMOS[i] = (Memo){0};
+    }
+
+    u32* params = ARENA_ALLOC(&ARENA_IR, u32, LEN_ESCAPES);
+    for (u32 i = 0; i < LEN_ESCAPES; ++i) {
+        params[i] = value_alloc(IR_PARAM, 0, 0);
+        IR_VALUES[params[i]].local = i;
+    }
+    phis_place(frontiers, starts, NULL);
+    return blocks_rename(params);
+}
+
+static u32 value_resolve(u32 value) {
+    while (FORWARD[value] != value) {
+        value = FORWARD[value];
+    }
+    return value;
+}
+
+static void values_forward_init(void) {
+    FORWARD = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_VALUES);
+    for (u32 i = 0; i < LEN_IR_VALUES; ++i) {
+        FORWARD[i] = i;
+    }
+}
+
+// NOTE: Points every operand past the values a pass replaced, and drops
+// those from their blocks.
+static void values_forward(void) {
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        IrBlock* block = &IR_BLOCKS[RPO[i]];
+        u32      kept = 0;
+        for (u32 j = 0; j < block->len_values; ++j) {
+            const u32 v = block->values[j];
+            if (FORWARD[v] != v) {
+                continue;
+            }
+            IrValue*  value = &IR_VALUES[v];
+            const u32 len_args = ir_len_args(value);
+            for (u32 k = 0; k < len_args; ++k) {
+                value->args[k] = value_resolve(value->args[k]);
+            }
+            block->values[kept++] = v;
+        }
+        block->len_values = kept;
+        if (block->term == IR_JZ) {
+            block->cond = value_resolve(block->cond);
+        }
+        for (u32 j = 0; j < LEN_ESCAPES; ++j) {
+            block->outs[j] = value_resolve(block->outs[j]);
+        }
+    }
+}
+
+static Bool value_is_const(u32 v, i64 imm) {
+    return (IR_VALUES[v].op == IR_CONST) && (IR_VALUES[v].imm == imm);
+}
+
+static void value_to_const(IrValue* value, i64 imm) {
+    value->op = IR_CONST;
+    value->imm = imm;
+}
+
+// NOTE: A phi whose operands all agree, besides itself, is that operand.
+static u32 phi_same(u32 v) {
+    const IrValue* value = &IR_VALUES[v];
+    u32            same = IR_NONE;
+    for (u32 i = 0; i < IR_BLOCKS[value->block].len_preds; ++i) {
+        const u32 arg = value->args[i];
+        if ((arg == v) || (arg == same)) {
+            continue;
+        }
+        if (same == IR_NONE) {
+            same = arg;
+            continue;
+        }
+        if ((IR_VALUES[same].op != IR_CONST) ||
+            !value_is_const(arg, IR_VALUES[same].imm))
+        {
+            return IR_NONE;
+        }
+    }
+    return same;
+}
+
+// NOTE: Folds operators on constants the way the interpreter computes them,
+// and drops those that give back an operand. Arithmetic that would overflow
+// is left for run time.
+static Bool value_fold(u32 v) {
+    IrValue*       value = &IR_VALUES[v];
+    const u32      l = value->args[0];
+    const u32      r = value->args[1];
+    const IrValue* left = &IR_VALUES[l];
+    const IrValue* right = &IR_VALUES[r];
+    const Bool     consts = (left->op == IR_CONST) && (right->op == IR_CONST);
+    switch (value->op) {
+    case IR_LT: {
+        if (consts || (l == r)) {
+            value_to_const(value, consts && (left->imm < right->imm));
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_EQ: {
+        if (consts || (l == r)) {
+            value_to_const(value, !consts || (left->imm == right->imm));
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_AND: {
+        if (consts) {
+            value_to_const(value,
+                           (i64)((u64)left->imm & (u64)right->imm));
+            return TRUE;
+        }
+        if (value_is_const(l, 0) || value_is_const(r, 0)) {
+            value_to_const(value, 0);
+            return TRUE;
+        }
+        if (l == r) {
+            FORWARD[v] = l;
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_ADD: {
+        i64 imm = 0;
+        if (consts) {
+            if (__builtin_add_overflow(left->imm, right->imm, &imm)) {
+                return FALSE;
+            }
+            value_to_const(value, imm);
+            return TRUE;
+        }
+        if (value_is_const(r, 0)) {
+            FORWARD[v] = l;
+            return TRUE;
+        }
+        if (value_is_const(l, 0)) {
+            FORWARD[v] = r;
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_SUB: {
+        i64 imm = 0;
+        if (consts) {
+            if (__builtin_sub_overflow(left->imm, right->imm, &imm)) {
+                return FALSE;
+            }
+            value_to_const(value, imm);
+            return TRUE;
+        }
+        if (l == r) {
+            value_to_const(value, 0);
+            return TRUE;
+        }
+        if (value_is_const(r, 0)) {
+            FORWARD[v] = l;
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_MUL: {
+        i64 imm = 0;
+        if (consts) {
+            if (__builtin_mul_overflow(left->imm, right->imm, &imm)) {
+                return FALSE;
+            }
+            value_to_const(value, imm);
+            return TRUE;
+        }
+        if (value_is_const(l, 0) || value_is_const(r, 0)) {
+            value_to_const(value, 0);
+            return TRUE;
+        }
+        if (value_is_const(r, 1)) {
+            FORWARD[v] = l;
+            return TRUE;
+        }
+        if (value_is_const(l, 1)) {
+            FORWARD[v] = r;
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_SHR: {
+        if (consts && (0 <= right->imm) && (right->imm < 64)) {
+            value_to_const(value, (i64)((u64)left->imm >> right->imm));
+            return TRUE;
+        }
+        if (value_is_const(r, 0)) {
+            FORWARD[v] = l;
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_SELECT: {
+        if (left->op == IR_CONST) {
+            FORWARD[v] = value->args[left->imm != 0 ? 1 : 2];
+            return TRUE;
+        }
+        if (r == value->args[2]) {
+            FORWARD[v] = r;
+            return TRUE;
+        }
+        return FALSE;
+    }
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_PHI:
+    default: {
+        return FALSE;
+    }
+    }
+}
+
+// NOTE: Constant propagation. Operators on constants fold, phis that merge
+// one value become it, and a branch on a constant becomes a jump, which may
+// leave blocks unreachable.
+static Bool ir_fold(void) {
+    values_forward_init();
+    Bool changed = FALSE;
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        const IrBlock* block = &IR_BLOCKS[RPO[i]];
+        for (u32 j = 0; j < block->len_values; ++j) {
+            const u32 v = block->values[j];
+            IrValue*  value = &IR_VALUES[v];
+            const u32 len_args = ir_len_args(value);
+            for (u32 k = 0; k < len_args; ++k) {
+                value->args[k] = value_resolve(value->args[k]);
+            }
+            if (value->op == IR_PHI) {
+                const u32 same = phi_same(v);
+                if (same != IR_NONE) {
+                    FORWARD[v] = same;
+                    changed = TRUE;
+                }
+            } else if ((len_args != 0) && value_fold(v)) {
+                changed = TRUE;
+            }
+        }
+    }
+    values_forward();
+
+    Bool pruned = FALSE;
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        IrBlock* block = &IR_BLOCKS[RPO[i]];
+        if ((block->term != IR_JZ) || (IR_VALUES[block->cond].op != IR_CONST))
+        {
+            continue;
+        }
+        const Bool zero = IR_VALUES[block->cond].imm == 0;
+        const u32  taken = block->succs[zero];
+        IrBlock*   other = &IR_BLOCKS[block->succs[!zero]];
+        for (u32 j = 0; j < other->len_preds; ++j) {
+            if (other->preds[j] == RPO[i]) {
+                block_pred_remove(other, j);
+                break;
+            }
+        }
+        block->term = IR_JMP;
+        block->succs[0] = taken;
+        block->cond = IR_NONE;
+        pruned = TRUE;
+    }
+    if (pruned) {
+        blocks_order();
+    }
+    return changed || pruned;
+}
+
+static u32 value_hash(const IrValue* value) {
+    u32 hash = hash_word(HASH_SEED, value->op);
+    hash = hash_word(hash, (u64)value->imm);
+    if (value->op == IR_PHI) {
+        hash = hash_word(hash, value->block);
+    }
+    const u32 len_args = ir_len_args(value);
+    for (u32 i = 0; i < len_args; ++i) {
+        hash = hash_word(hash, value->args[i]);
+    }
+    return hash;
+}
+
+static Bool values_same(const IrValue* a, const IrValue* b) {
+    if ((a->op != b->op) || (a->imm != b->imm) ||
+        ((a->op == IR_PHI) && (a->block != b->block)))
+    {
+        return FALSE;
+    }
+    const u32 len_args = ir_len_args(a);
+    for (u32 i = 0; i < len_args; ++i) {
+        if (a->args[i] != b->args[i]) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// NOTE: Commutative operands go in order of index, except that a constant
+// always goes second, where it can become an immediate.
+static Bool args_unsorted(const u32* args) {
+    const Bool left = IR_VALUES[args[0]].op == IR_CONST;
+    const Bool right = IR_VALUES[args[1]].op == IR_CONST;
+    if (left != right) {
+        return left;
+    }
+    return args[1] < args[0];
+}
+
+// NOTE: Global value numbering over the dominator tree: a value the same as
+// one computed in a block that dominates it is replaced by that one.
+// Commutative operators have their operands sorted first.
+static Bool ir_gvn(void) {
+    values_forward_init();
+    u32 cap = 1 << 3;
+    while (cap < (2 * (u64)LEN_IR_VALUES)) {
+        cap <<= 1;
+    }
+    u32* slots = ARENA_ALLOC(&ARENA_IR, u32, cap);
+    for (u32 i = 0; i < cap; ++i) {
+        slots[i] = IR_NONE;
+    }
+
+    Bool changed = FALSE;
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        const IrBlock* block = &IR_BLOCKS[RPO[i]];
+        for (u32 j = 0; j < block->len_values; ++j) {
+            const u32 v = block->values[j];
+            IrValue*  value = &IR_VALUES[v];
+            const u32 len_args = ir_len_args(value);
+            for (u32 k = 0; k < len_args; ++k) {
+                value->args[k] = value_resolve(value->args[k]);
+            }
+            if (value->op == IR_PARAM) {
+                continue;
+            }
+            if (((value->op == IR_EQ) || (value->op == IR_AND) ||
+                 (value->op == IR_ADD) || (value->op == IR_MUL)) &&
+                args_unsorted(value->args))
+            {
+                const u32 arg = value->args[0];
+                value->args[0] = value->args[1];
+                value->args[1] = arg;
+            }
+
+            u32 k = value_hash(value) & (cap - 1);
+            for (; slots[k] != IR_NONE; k = (k + 1) & (cap - 1)) {
+                const IrValue* other = &IR_VALUES[slots[k]];
+                if (values_same(other, value) &&
+                    ((value->op == IR_CONST) ||
+                     block_dominates(other->block, value->block)))
+                {
+                    break;
+                }
+            }
+            if (slots[k] == IR_NONE) {
+                slots[k] = v;
+            } else {
+                FORWARD[v] = slots[k];
+                changed = TRUE;
+            }
+        }
+    }
+    values_forward();
+    return changed;
+}
+
+// NOTE: Dead code elimination. A value is live if a branch tests it, an
+// exit writes it back, or a live value reads it. A local's own entry value
+// needs no writing back.
+static Bool ir_dce(void) {
+    Bool* live = ARENA_ALLOC(&ARENA_IR, Bool, LEN_IR_VALUES);
+    u32*  work = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_VALUES);
+    u32   len_work = 0;
+    for (u32 i = 0; i < LEN_IR_VALUES; ++i) {
+        live[i] = FALSE;
+    }
+
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        const IrBlock* block = &IR_BLOCKS[RPO[i]];
+        if ((block->term == IR_JZ) && !live[block->cond]) {
+            live[block->cond] = TRUE;
+            work[len_work++] = block->cond;
+        }
+        for (u32 j = 0; (block->term == IR_EXIT) && (j < LEN_ESCAPES); ++j) {
+            const u32      v = block->outs[j];
+            const IrValue* value = &IR_VALUES[v];
+            if (!live[v] && ((value->op != IR_PARAM) || (value->local != j))) {
+                live[v] = TRUE;
+                work[len_work++] = v;
+            }
+        }
+    }
+    while (len_work != 0) {
+        const IrValue* value = &IR_VALUES[work[--len_work]];
+        const u32      len_args = ir_len_args(value);
+        for (u32 i = 0; i < len_args; ++i) {
+            if (!live[value->args[i]]) {
+                live[value->args[i]] = TRUE;
+                work[len_work++] = value->args[i];
+            }
+        }
+    }
+
+    Bool changed = FALSE;
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        IrBlock* block = &IR_BLOCKS[RPO[i]];
+        u32      kept = 0;
+        for (u32 j = 0; j < block->len_values; ++j) {
+            if (live[block->values[j]]) {
+                block->values[kept++] = block->values[j];
+            }
+        }
+        changed = changed || (kept != block->len_values);
+        block->len_values = kept;
+    }
+    return changed;
+}
+
+static Bool value_is_invariant(const IrValue* value, const Bool* body) {
+    switch (value->op) {
+    case IR_LT:
+    case IR_EQ:
+    case IR_AND:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_SHR:
+    case IR_SELECT: {
+        const u32 len_args = ir_len_args(value);
+        for (u32 i = 0; i < len_args; ++i) {
+            if (body[IR_VALUES[value->args[i]].block]) {
+                return FALSE;
+            }
+        }
+        return TRUE;
+    }
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_PHI:
+    default: {
+        return FALSE;
+    }
+    }
+}
+
+// NOTE: A loop is a header with the blocks that reach one of its back edges
+// without passing through it; these are the ranges `insts_run` records in
+// `LOOPS`. Marks them in `body` and returns the preheader, the one
+// predecessor from outside, which jumps straight to the header. Returns
+// `IR_NONE` if `h` heads no loop, or is entered from more than one block.
+// Only a header clears `body`, so trying every block stays cheap.
+static u32 loop_find(u32 h, Bool* body, u32* work) {
+    const IrBlock* header = &IR_BLOCKS[h];
+    u32            preheader = IR_NONE;
+    u32            len_outside = 0;
+    for (u32 i = 0; i < header->len_preds; ++i) {
+        if (!block_dominates(h, header->preds[i])) {
+            preheader = header->preds[i];
+            ++len_outside;
+        }
+    }
+    if ((len_outside != 1) || (header->len_preds == 1)) {
+        return IR_NONE;
+    }
+
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        body[i] = FALSE;
+    }
+    body[h] = TRUE;
+    u32 len_work = 0;
+    for (u32 i = 0; i < header->len_preds; ++i) {
+        const u32 pred = header->preds[i];
+        if ((pred != preheader) && !body[pred]) {
+            body[pred] = TRUE;
+            work[len_work++] = pred;
+        }
+    }
+    while (len_work != 0) {
+        const IrBlock* block = &IR_BLOCKS[work[--len_work]];
+        for (u32 i = 0; i < block->len_preds; ++i) {
+            if (!body[block->preds[i]]) {
+                body[block->preds[i]] = TRUE;
+                work[len_work++] = block->preds[i];
+            }
+        }
+    }
+    return preheader;
+}
+
+// NOTE: Gives `block` room for `len` more values.
+static void block_values_grow(IrBlock* block, u32 len) {
+    u32* values = ARENA_ALLOC(&ARENA_IR, u32, block->len_values + len);
+    for (u32 i = 0; i < block->len_values; ++i) {
+        values[i] = block->values[i];
+    }
+    block->values = values;
+}
+
+// NOTE: Loop-invariant code motion. An operator that reads nothing the loop
+// computes moves to the end of the preheader. Inner loops go first, so a
+// value climbs out of a whole nest in one pass. A local the loop never
+// stores is already read once, in block `0`.
+static Bool ir_licm(void) {
+    Bool* body = ARENA_ALLOC(&ARENA_IR, Bool, LEN_IR_BLOCKS);
+    u32*  work = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    u32*  moved = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_VALUES);
+    Bool  changed = FALSE;
+    for (u32 i = LEN_RPO; i != 0;) {
+        const u32 h = RPO[--i];
+        const u32 preheader = loop_find(h, body, work);
+        if (preheader == IR_NONE) {
+            continue;
+        }
+
+        // NOTE: In reverse postorder, so whatever a value reads has moved
+        // out ahead of it.
+        u32 len_moved = 0;
+        for (u32 j = ORDER[h]; j < LEN_RPO; ++j) {
+            if (!body[RPO[j]]) {
+                continue;
+            }
+            IrBlock* block = &IR_BLOCKS[RPO[j]];
+            u32      kept = 0;
+            for (u32 k = 0; k < block->len_values; ++k) {
+                const u32 v = block->values[k];
+                IrValue*  value = &IR_VALUES[v];
+                if (value_is_invariant(value, body)) {
+                    value->block = preheader;
+                    moved[len_moved++] = v;
+                } else {
+                    block->values[kept++] = v;
+                }
+            }
+            block->len_values = kept;
+        }
+        if (len_moved == 0) {
+            continue;
+        }
+        IrBlock* block = &IR_BLOCKS[preheader];
+        block_values_grow(block, len_moved);
+        for (u32 j = 0; j < len_moved; ++j) {
+            block->values[block->len_values++] = moved[j];
+        }
+        changed = TRUE;
+    }
+    return changed;
+}
+
+// NOTE: How much a value in a loop changes by from one iteration to the
+// next, when that is the same every time.
+typedef struct {
+    i64  step;
+    Bool affine;
+} Evolution;
+
+// NOTE: Whatever `v` steps by is in `evolutions`, unless the loop never
+// computes it.
+static Evolution value_evolution(u32              v,
+                                 const Bool*      body,
+                                 const Evolution* evolutions) {
+    return body[IR_VALUES[v].block] ? evolutions[v]
+                                    : (Evolution){.step = 0, .affine = TRUE};
+}
+
+static Evolution value_evolve(const IrValue*   value,
+                              const Bool*      body,
+                              const Evolution* evolutions) {
+    const Evolution none = {.step = 0, .affine = FALSE};
+    if (ir_len_args(value) != 2) {
+        return none;
+    }
+    const Evolution l = value_evolution(value->args[0], body, evolutions);
+    const Evolution r = value_evolution(value->args[1], body, evolutions);
+    if (!l.affine || !r.affine) {
+        return none;
+    }
+    Evolution evolution = {.step = 0, .affine = TRUE};
+    if ((l.step == 0) && (r.step == 0)) {
+        return evolution;
+    }
+    switch (value->op) {
+    case IR_ADD: {
+        return __builtin_add_overflow(l.step, r.step, &evolution.step)
+                   ? none
+                   : evolution;
+    }
+    case IR_SUB: {
+        return __builtin_sub_overflow(l.step, r.step, &evolution.step)
+                   ? none
+                   : evolution;
+    }
+    case IR_MUL: {
+        const IrValue* left = &IR_VALUES[value->args[0]];
+        const IrValue* right = &IR_VALUES[value->args[1]];
+        if ((r.step == 0) && (right->op == IR_CONST)) {
+            return __builtin_mul_overflow(l.step, right->imm, &evolution.step)
+                       ? none
+                       : evolution;
+        }
+        if ((l.step == 0) && (left->op == IR_CONST)) {
+            return __builtin_mul_overflow(r.step, left->imm, &evolution.step)
+                       ? none
+                       : evolution;
+        }
+        return none;
+    }
+    case IR_CONST:
+    case IR_PARAM:
+    case IR_PHI:
+    case IR_LT:
+    case IR_EQ:
+    case IR_AND:
+    case IR_SHR:
+    case IR_SELECT:
+    default: {
+        return none;
+    }
+    }
+}
+
+// NOTE: A header phi is a basic induction variable when what comes round
+// the back edge, in slot `slot`, is itself plus a constant.
+static Evolution phi_evolution(u32 v, u32 slot) {
+    const IrValue* next = &IR_VALUES[IR_VALUES[v].args[slot]];
+    if (next->op != IR_ADD) {
+        return (Evolution){.step = 0, .affine = FALSE};
+    }
+    const u32 step = next->args[0] == v   ? next->args[1]
+                     : next->args[1] == v ? next->args[0]
+                                          : IR_NONE;
+    if ((step == IR_NONE) || (IR_VALUES[step].op != IR_CONST)) {
+        return (Evolution){.step = 0, .affine = FALSE};
+    }
+    return (Evolution){.step = IR_VALUES[step].imm, .affine = TRUE};
+}
+
+static u32 value_binary(IrOp op, u32 block, u32 l, u32 r) {
+    const u32 v = value_alloc(op, block, 2);
+    IR_VALUES[v].args[0] = l;
+    IR_VALUES[v].args[1] = r;
+    return v;
+}
+
+static u32 value_const(u32 block, i64 imm) {
+    const u32 v = value_alloc(IR_CONST, block, 0);
+    IR_VALUES[v].imm = imm;
+    return v;
+}
+
+// NOTE: `n * (n - 1) / 2`, halving whichever factor is even, so that it
+// wraps the way adding up `0` to `n - 1` one at a time would.
+static u32 value_triangle(u32 block, u32 n) {
+    const u32 odd = value_binary(IR_AND, block, n, value_const(block, 1));
+    const u32 even = value_binary(IR_SUB, block, n, odd);
+    const u32 half = value_binary(IR_SHR, block, even, value_const(block, 1));
+    const u32 less = value_binary(IR_ADD, block, n, value_const(block, -1));
+    const u32 other = value_binary(IR_ADD, block, less, odd);
+    return value_binary(IR_MUL, block, half, other);
+}
+
+// NOTE: A loop whose header tests `lt(i, bound)`, with `i` stepping up by
+// one, or `lt(bound, i)`, with `i` stepping down by one, runs `n` more
+// times once it is in its body, where `n` is the difference. When every
+// other local it carries round only ever adds a value that steps evenly,
+// the latch can work out where each one ends up after all `n` iterations,
+// and the loop goes round once. The body must be a straight line back to
+// the header, the only way out.
+static u32 loop_close(u32 h, const Bool* body) {
+    const IrBlock* header = &IR_BLOCKS[h];
+    if ((header->term != IR_JZ) || !body[header->succs[0]] ||
+        body[header->succs[1]])
+    {
+        return ERROR;
+    }
+    u32 latch = IR_NONE;
+    u32 slot = 0;
+    for (u32 i = 0; i < header->len_preds; ++i) {
+        if (!body[header->preds[i]]) {
+            continue;
+        }
+        if (latch != IR_NONE) {
+            return ERROR;
+        }
+        latch = header->preds[i];
+        slot = i;
+    }
+    for (u32 i = ORDER[h] + 1; i < LEN_RPO; ++i) {
+        if (body[RPO[i]] && (IR_BLOCKS[RPO[i]].term != IR_JMP)) {
+            return ERROR;
+        }
+    }
+
+    Evolution* evolutions = ARENA_ALLOC(&ARENA_IR, Evolution, LEN_IR_VALUES);
+    u32        len_phis = 0;
+    for (u32 i = 0; i < header->len_values; ++i) {
+        const u32      v = header->values[i];
+        const IrValue* phi = &IR_VALUES[v];
+        if (phi->op != IR_PHI) {
+            break;
+        }
+        ++len_phis;
+        evolutions[v] = phi_evolution(v, slot);
+    }
+    for (u32 i = ORDER[h]; i < LEN_RPO; ++i) {
+        if (!body[RPO[i]]) {
+            continue;
+        }
+        const IrBlock* block = &IR_BLOCKS[RPO[i]];
+        for (u32 j = 0; j < block->len_values; ++j) {
+            const u32 v = block->values[j];
+            if (IR_VALUES[v].op != IR_PHI) {
+                evolutions[v] = value_evolve(&IR_VALUES[v], body, evolutions);
+            }
+        }
+    }
+
+    const IrValue* cond = &IR_VALUES[header->cond];
+    if (cond->op != IR_LT) {
+        return ERROR;
+    }
+    const u32       l = cond->args[0];
+    const u32       r = cond->args[1];
+    const Evolution left = value_evolution(l, body, evolutions);
+    const Evolution right = value_evolution(r, body, evolutions);
+    if (!left.affine || !right.affine) {
+        return ERROR;
+    }
+    const Bool up = (IR_VALUES[l].op == IR_PHI) && (IR_VALUES[l].block == h) &&
+                    (left.step == 1) && (right.step == 0);
+    const Bool down = (IR_VALUES[r].op == IR_PHI) &&
+                      (IR_VALUES[r].block == h) && (right.step == -1) &&
+                      (left.step == 0);
+    if (!up && !down) {
+        return ERROR;
+    }
+    const u32 counter = up ? l : r;
+
+    // NOTE: What each phi adds every time round, and how much that grows.
+    u32*       adds = ARENA_ALLOC(&ARENA_IR, u32, len_phis);
+    Evolution* growths = ARENA_ALLOC(&ARENA_IR, Evolution, len_phis);
+    Bool       triangle = FALSE;
+    for (u32 i = 0; i < len_phis; ++i) {
+        const u32      v = header->values[i];
+        const u32      n = IR_VALUES[v].args[slot];
+        const IrValue* next = &IR_VALUES[n];
+        adds[i] = IR_NONE;
+        if (v == counter) {
+            continue;
+        }
+        if ((next->op == IR_ADD) &&
+            ((next->args[0] == v) || (next->args[1] == v)))
+        {
+            adds[i] = next->args[0] == v ? next->args[1] : next->args[0];
+            growths[i] = value_evolution(adds[i], body, evolutions);
+            triangle = triangle || (growths[i].step != 0);
+        } else {
+            growths[i] = value_evolution(n, body, evolutions);
+            if (growths[i].step != 0) {
+                return ERROR;
+            }
+        }
+        if (!growths[i].affine) {
+            return ERROR;
+        }
+    }
+
+    block_values_grow(&IR_BLOCKS[latch], 16 + (8 * len_phis));
+    const u32 count = value_binary(IR_SUB, latch, r, l);
+    const u32 sum = triangle ? value_triangle(latch, count) : IR_NONE;
+    for (u32 i = 0; i < len_phis; ++i) {
+        IrValue* phi = &IR_VALUES[IR_BLOCKS[h].values[i]];
+        if (IR_BLOCKS[h].values[i] == counter) {
+            phi->args[slot] = up ? r : l;
+            continue;
+        }
+        if (adds[i] == IR_NONE) {
+            continue;
+        }
+        u32 total = value_binary(IR_MUL, latch, count, adds[i]);
+        if (growths[i].step != 0) {
+            const u32 step = value_const(latch, growths[i].step);
+            total = value_binary(IR_ADD,
+                                 latch,
+                                 total,
+                                 value_binary(IR_MUL, latch, sum, step));
+        }
+        phi->args[slot] =
+            value_binary(IR_ADD, latch, IR_BLOCKS[h].values[i], total);
+    }
+    return OK;
+}
+
+// NOTE: Scalar evolution. Inner loops go first, and each loop `loop_close`
+// can evaluate goes round once instead; what it computed on the way is then
+// dead. The language has no multiply, so an induction variable derived from
+// another is already just an `add` of it, and there is nothing to reduce.
+static Bool ir_scev(void) {
+    Bool* body = ARENA_ALLOC(&ARENA_IR, Bool, LEN_IR_BLOCKS);
+    u32*  work = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    Bool  changed = FALSE;
+    for (u32 i = LEN_RPO; i != 0;) {
+        const u32 h = RPO[--i];
+        if ((loop_find(h, body, work) != IR_NONE) &&
+            (loop_close(h, body) == OK))
+        {
+            changed = TRUE;
+        }
+    }
+    return changed;
+}
+
+typedef Bool (*IrPass)(void);
+
+static const IrPass IR_PASSES[] = {
+    ir_fold,
+    ir_gvn,
+    ir_dce,
+    ir_licm,
+    ir_scev,
+};
+
+#define LEN_IR_PASSES (sizeof(IR_PASSES) / sizeof(IR_PASSES[0]))
+
+// NOTE: Runs every pass in turn until a whole round of them changes nothing,
+// or `IR_ROUNDS` run out.
+static void ir_passes(void) {
+    Bool changed = TRUE;
+    for (u32 i = IR_ROUNDS; changed && (i != 0); --i) {
+        changed = FALSE;
+        for (u32 j = 0; j < LEN_IR_PASSES; ++j) {
+            changed = IR_PASSES[j]() || changed;
+        }
+    }
+}
+
+// NOTE: One side of a diamond: a block entered only from the branch, with
+// no phis, that jumps straight to `join`.
+static Bool diamond_side(u32 side, u32 join) {
+    const IrBlock* block = &IR_BLOCKS[side];
+    return (block->len_preds == 1) && (block->term == IR_JMP) &&
+           (block->succs[0] == join) && (side != join) &&
+           ((block->len_values == 0) ||
+            (IR_VALUES[block->values[0]].op != IR_PHI));
+}
+
+// NOTE: Whether the profile shows branch `b` going one way nearly every
+// time. The interpreter only counts jumps taken: the branch's own are its
+// zero side, and its non-zero side falls through, so that side is only
+// counted when it ends in a jump to the join. Without both counts the branch
+// is taken to be unpredictable.
+static Bool diamond_biased(u32 b, u32 join) {
+    const Source* source = &SOURCES[b];
+    const u32     nonzero = IR_BLOCKS[b].succs[0];
+    const u32     zero = IR_BLOCKS[b].succs[1];
+    if ((source->target == NULL) || (SOURCES[nonzero].target == NULL)) {
+        return FALSE;
+    }
+    const u64  taken = label_jumps(source->target);
+    const Bool joined = (SOURCES[zero].target != NULL) ||
+                        (*table_find(&IR_LABELS, source->target) == join);
+    const u64  jumps = SOURCES[join].jumps;
+    if (joined && (jumps < taken)) {
+        return FALSE;
+    }
+    const u64 fallen = jumps - (joined ? taken : 0);
+    const u64 rare = taken < fallen ? taken : fallen;
+    return (rare * SELECT_BIAS) < (taken + fallen);
+}
+
+// NOTE: If-conversion. A branch whose two sides hold a few operators each
+// and meet again at a join becomes a jump straight to it: both sides are
+// computed before the branch, and every phi of the join becomes a select on
+// its condition, which lowers to a `cmov`. No operator can trap, so computing
+// the side not taken is harmless.
+static Bool ir_select(void) {
+    Bool changed = FALSE;
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        const u32 b = RPO[i];
+        IrBlock*  block = &IR_BLOCKS[b];
+        if (block->term != IR_JZ) {
+            continue;
+        }
+        const u32 nonzero = block->succs[0];
+        const u32 zero = block->succs[1];
+        const u32 j = IR_BLOCKS[nonzero].succs[0];
+        IrBlock*  join = &IR_BLOCKS[j];
+        if (!diamond_side(nonzero, j) || !diamond_side(zero, j) ||
+            (join->len_preds != 2))
+        {
+            continue;
+        }
+        u32 len_phis = 0;
+        while ((len_phis < join->len_values) &&
+               (IR_VALUES[join->values[len_phis]].op == IR_PHI))
+        {
+            ++len_phis;
+        }
+        const u32 len = IR_BLOCKS[nonzero].len_values +
+                        IR_BLOCKS[zero].len_values + len_phis;
+        if ((SELECT_VALUES < len) || diamond_biased(b, j)) {
+            continue;
+        }
+
+        block_values_grow(block, len);
+        const u32 sides[] = {nonzero, zero};
+        for (u32 k = 0; k < 2; ++k) {
+            IrBlock* side = &IR_BLOCKS[sides[k]];
+            for (u32 l = 0; l < side->len_values; ++l) {
+                IR_VALUES[side->values[l]].block = b;
+                block->values[block->len_values++] = side->values[l];
+            }
+            side->len_values = 0;
+        }
+        const u32 slot = join->preds[0] == nonzero ? 0 : 1;
+        for (u32 k = 0; k < len_phis; ++k) {
+            const u32 v = join->values[k];
+            IrValue*  value = &IR_VALUES[v];
+            u32*      args = ARENA_ALLOC(&ARENA_IR, u32, 3);
+            args[0] = block->cond;
+            args[1] = value->args[slot];
+            args[2] = value->args[!slot];
+            value->args = args;
+            value->op = IR_SELECT;
+            value->block = b;
+            block->values[block->len_values++] = v;
+        }
+        for (u32 k = len_phis; k < join->len_values; ++k) {
+            join->values[k - len_phis] = join->values[k];
+        }
+        join->len_values -= len_phis;
+        join->preds[0] = b;
+        join->len_preds = 1;
+
+        block->term = IR_JMP;
+        block->succs[0] = j;
+        block->cond = IR_NONE;
+        changed = TRUE;
+    }
+    if (changed) {
+        blocks_order();
+    }
+    return changed;
+}
+
+// NOTE: What `loop_unroll` needs of a loop. `blocks` holds it in reverse
+// postorder, header first; `pre` and `latch` are the slots of the header's
+// predecessors from the preheader and round the back edge.
+typedef struct {
+    u32* blocks;
+    u32  len_blocks;
+    u32  header;
+    u32  preheader;
+    u32  pre;
+    u32  latch;
+    u32  len_values;
+} Loop;
+
+// NOTE: A loop `loop_close` has evaluated sends its bound round the back
+// edge in place of its counter, so it never goes round twice, and neither
+// does one whose test has folded to a constant. Unrolling either only adds
+// copies that never run.
+static Bool loop_once(const Loop* loop) {
+    const u32      h = loop->header;
+    const IrValue* cond = &IR_VALUES[IR_BLOCKS[h].cond];
+    if (cond->op == IR_CONST) {
+        return TRUE;
+    }
+    if (cond->op != IR_LT) {
+        return FALSE;
+    }
+    for (u32 i = 0; i < 2; ++i) {
+        const IrValue* phi = &IR_VALUES[cond->args[i]];
+        if ((phi->op == IR_PHI) && (phi->block == h) &&
+            (phi->args[loop->latch] == cond->args[1 - i]))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// NOTE: An innermost loop that only leaves from its header, comes back to
+// it along one edge, and goes round more than once.
+static u32 loop_unrollable(u32         h,
+                           const Bool* body,
+                           u32         preheader,
+                           Loop*       loop) {
+    const IrBlock* header = &IR_BLOCKS[h];
+    if ((header->term != IR_JZ) || !body[header->succs[0]] ||
+        body[header->succs[1]] || (header->len_preds != 2))
+    {
+        return ERROR;
+    }
+    *loop = (Loop){
+        .blocks = ARENA_ALLOC(&ARENA_IR, u32, LEN_RPO - ORDER[h]),
+        .header = h,
+        .preheader = preheader,
+        .pre = header->preds[0] == preheader ? 0 : 1,
+        .latch = header->preds[0] == preheader ? 1 : 0,
+    };
+    for (u32 i = ORDER[h]; i < LEN_RPO; ++i) {
+        const u32      b = RPO[i];
+        const IrBlock* block = &IR_BLOCKS[b];
+        if (!body[b]) {
+            continue;
+        }
+        loop->blocks[loop->len_blocks++] = b;
+        loop->len_values += block->len_values;
+        if (b == h) {
+            continue;
+        }
+        if (block->term == IR_EXIT) {
+            return ERROR;
+        }
+        for (u32 j = 0; j < ir_len_succs(block); ++j) {
+            if (!body[block->succs[j]]) {
+                return ERROR;
+            }
+        }
+        for (u32 j = 0; j < block->len_preds; ++j) {
+            if (block_dominates(b, block->preds[j])) {
+                return ERROR;
+            }
+        }
+    }
+    if (loop_once(loop)) {
+        return ERROR;
+    }
+    return OK;
+}
+
+// NOTE: A loop counting a basic induction variable up or down, by a constant
+// step, to a constant bound, goes round at least `factor` more times when it
+// is `(factor - 1)` steps short of the bound; that is what `bound` becomes.
+static Bool loop_counted(const Loop* loop,
+                         u32         factor,
+                         u32*        counter,
+                         i64*        bound) {
+    const IrValue* cond = &IR_VALUES[IR_BLOCKS[loop->header].cond];
+    if (cond->op != IR_LT) {
+        return FALSE;
+    }
+    for (u32 i = 0; i < 2; ++i) {
+        const u32      phi = cond->args[i];
+        const IrValue* other = &IR_VALUES[cond->args[1 - i]];
+        if ((IR_VALUES[phi].op != IR_PHI) ||
+            (IR_VALUES[phi].block != loop->header) ||
+            (other->op != IR_CONST))
+        {
+            continue;
+        }
+        const Evolution evolution = phi_evolution(phi, loop->latch);
+        i64             distance = 0;
+        if (!evolution.affine || ((i == 0) && (evolution.step <= 0)) ||
+            ((i == 1) && (0 <= evolution.step)) ||
+            __builtin_mul_overflow(evolution.step,
+                                   (i64)factor - 1,
+                                   &distance) ||
+            __builtin_sub_overflow(other->imm, distance, bound))
+        {
+            return FALSE;
+        }
+        *counter = phi;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// NOTE: Chains `factor` copies of the loop into one that goes round once
+// for every `factor` iterations. Every copy tests where the original does,
+// and leaves to the original header, which tests again and goes on from
+// there; so the original loop is what runs the iterations left over. A
+// counted loop is tested once, up front, for a whole round of copies.
+static void loop_unroll(const Loop* loop, u32 factor) {
+    const u32      base = LEN_IR_BLOCKS;
+    const u32      h = loop->header;
+    const IrBlock* header = &IR_BLOCKS[h];
+    const u32      len = loop->len_blocks;
+    u32            counter = IR_NONE;
+    i64            bound = 0;
+    const Bool     counted = loop_counted(loop, factor, &counter, &bound);
+    const u32      len_exits = counted ? 1 : factor;
+
+    u32* positions = ARENA_ALLOC(&ARENA_IR, u32, base);
+    u32* copies = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_VALUES);
+    for (u32 i = 0; i < LEN_IR_VALUES; ++i) {
+        copies[i] = i;
+    }
+    for (u32 i = 0; i < len; ++i) {
+        positions[loop->blocks[i]] = i;
+    }
+    u32 len_phis = 0;
+    while ((len_phis < header->len_values) &&
+           (IR_VALUES[header->values[len_phis]].op == IR_PHI))
+    {
+        ++len_phis;
+    }
+    u32*  nexts = ARENA_ALLOC(&ARENA_IR, u32, len_phis);
+    u32** exits = ARENA_ALLOC(&ARENA_IR, u32*, factor);
+    for (u32 i = 0; i < (factor * (len + 1)); ++i) {
+        block_alloc();
+    }
+
+    for (u32 k = 0; k < factor; ++k) {
+        const u32 first = base + (k * len);
+        const u32 next = (k + 1) < factor ? first + len : base;
+        const u32 exit = base + (factor * len) + k;
+        for (u32 i = 0; i < len; ++i) {
+            const IrBlock* from = &IR_BLOCKS[loop->blocks[i]];
+            IrBlock*       to = &IR_BLOCKS[first + i];
+            to->label = from->label;
+            to->values = ARENA_ALLOC(&ARENA_IR, u32, from->len_values + 2);
+            to->len_preds = i != 0 ? from->len_preds : k == 0 ? 2 : 1;
+            to->preds = ARENA_ALLOC(&ARENA_IR, u32, to->len_preds);
+            to->term = from->term;
+            to->exit = from->exit;
+            to->runs = from->runs;
+            to->reachable = TRUE;
+        }
+
+        // NOTE: Each copy starts from what the one before it sent round the
+        // back edge.
+        for (u32 i = 0; i < len_phis; ++i) {
+            const IrValue* phi = &IR_VALUES[header->values[i]];
+            if (k == 0) {
+                nexts[i] = value_alloc(IR_PHI, first, 2);
+                IR_VALUES[nexts[i]].local = phi->local;
+            } else {
+                nexts[i] = copies[phi->args[loop->latch]];
+            }
+        }
+        exits[k] = ARENA_ALLOC(&ARENA_IR, u32, len_phis);
+        for (u32 i = 0; i < len_phis; ++i) {
+            copies[header->values[i]] = nexts[i];
+            exits[k][i] = nexts[i];
+        }
+
+        for (u32 i = 0; i < len; ++i) {
+            const IrBlock* from = &IR_BLOCKS[loop->blocks[i]];
+            IrBlock*       to = &IR_BLOCKS[first + i];
+            for (u32 j = i == 0 ? len_phis : 0; j < from->len_values; ++j) {
+                const u32      v = from->values[j];
+                const IrValue* value = &IR_VALUES[v];
+                const u32      len_args = ir_len_args(value);
+                const u32 copy = value_alloc(value->op, first + i, len_args);
+                IR_VALUES[copy].imm = value->imm;
+                IR_VALUES[copy].local = value->local;
+                for (u32 a = 0; a < len_args; ++a) {
+                    IR_VALUES[copy].args[a] = copies[value->args[a]];
+                }
+                copies[v] = copy;
+            }
+            for (u32 j = 0; j < ir_len_succs(from); ++j) {
+                const u32 succ = from->succs[j];
+                to->succs[j] = succ == h ? next : first + positions[succ];
+            }
+            for (u32 j = 0; (i != 0) && (j < from->len_preds); ++j) {
+                to->preds[j] = first + positions[from->preds[j]];
+            }
+            to->cond = from->term == IR_JZ ? copies[from->cond] : IR_NONE;
+            to->outs = ARENA_ALLOC(&ARENA_IR, u32, LEN_ESCAPES);
+            for (u32 j = 0; j < LEN_ESCAPES; ++j) {
+                to->outs[j] = copies[from->outs[j]];
+            }
+        }
+
+        IrBlock* copy = &IR_BLOCKS[first];
+        const u32 latch = positions[header->preds[loop->latch]];
+        copy->preds[0] = k == 0 ? loop->preheader : first - len + latch;
+        copy->succs[1] = exit;
+        if (counted && (k != 0)) {
+            copy->term = IR_JMP;
+            copy->cond = IR_NONE;
+        } else if (counted) {
+            const u32  c = value_const(first, bound);
+            const u32  l = copies[counter];
+            const Bool up = IR_VALUES[header->cond].args[0] == counter;
+            copy->cond = value_binary(IR_LT, first, up ? l : c, up ? c : l);
+        }
+        if (k < len_exits) {
+            IrBlock* out = &IR_BLOCKS[exit];
+            out->preds = ARENA_ALLOC(&ARENA_IR, u32, 1);
+            out->preds[0] = first;
+            out->len_preds = 1;
+            out->succs[0] = h;
+            out->outs = copy->outs;
+            out->term = IR_JMP;
+            out->reachable = TRUE;
+        }
+    }
+
+    IR_BLOCKS[base].preds[1] =
+        base + ((factor - 1) * len) + positions[header->preds[loop->latch]];
+    for (u32 i = 0; i < len_phis; ++i) {
+        const IrValue* phi = &IR_VALUES[header->values[i]];
+        IrValue*       copy = &IR_VALUES[exits[0][i]];
+        copy->args[0] = phi->args[loop->pre];
+        copy->args[1] = copies[phi->args[loop->latch]];
+    }
+
+    IrBlock* preheader = &IR_BLOCKS[loop->preheader];
+    for (u32 i = 0; i < ir_len_succs(preheader); ++i) {
+        if (preheader->succs[i] == h) {
+            preheader->succs[i] = base;
+        }
+    }
+    IrBlock* block = &IR_BLOCKS[h];
+    u32*     preds = ARENA_ALLOC(&ARENA_IR, u32, len_exits + 1);
+    for (u32 i = 0; i < len_exits; ++i) {
+        preds[i] = base + (factor * len) + i;
+    }
+    preds[len_exits] = header->preds[loop->latch];
+    for (u32 i = 0; i < len_phis; ++i) {
+        IrValue* phi = &IR_VALUES[header->values[i]];
+        u32*     args = ARENA_ALLOC(&ARENA_IR, u32, len_exits + 1);
+        for (u32 j = 0; j < len_exits; ++j) {
+            args[j] = exits[j][i];
+        }
+        args[len_exits] = phi->args[loop->latch];
+        phi->args = args;
+    }
+    block->preds = preds;
+    block->len_preds = len_exits + 1;
+}
+
+// NOTE: Unrolls every innermost loop it can, by as much as `IR_UNROLL` and
+// `UNROLL_VALUES` allow. Saves a compare and a taken jump on all but one
+// in every `factor` iterations, and, for a counted loop, the compare on
+// those as well.
+static Bool ir_unroll(void) {
+    u32* headers = ARENA_ALLOC(&ARENA_IR, u32, LEN_RPO);
+    u32  len_headers = 0;
+    Bool changed = FALSE;
+    for (u32 i = 0; i < LEN_RPO; ++i) {
+        headers[len_headers++] = RPO[i];
+    }
+    Bool* body = ARENA_ALLOC(&ARENA_IR, Bool, LEN_IR_BLOCKS);
+    u32*  work = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+    for (u32 i = 0; i < len_headers; ++i) {
+        const u32 h = headers[i];
+        const u32 preheader = loop_find(h, body, work);
+        Loop      loop = {0};
+        if ((preheader == IR_NONE) ||
+            (loop_unrollable(h, body, preheader, &loop) != OK))
+        {
+            continue;
+        }
+        u32 factor = loop.len_values == 0 ? IR_UNROLL
+                                          : UNROLL_VALUES / loop.len_values;
+        if (IR_UNROLL < factor) {
+            factor = IR_UNROLL;
+        }
+        if (factor < 2) {
+            continue;
+        }
+        loop_unroll(&loop, factor);
+        blocks_order();
+        body = ARENA_ALLOC(&ARENA_IR, Bool, LEN_IR_BLOCKS);
+        work = ARENA_ALLOC(&ARENA_IR, u32, LEN_IR_BLOCKS);
+        changed = TRUE;
+    }
+    return changed;
+}
+
+// NOTE: If-conversion waits until the passes have left as little as they
+// can on either side of a branch. Unrolling comes last, and the passes then
+// run again over the copies.
+void ir_optimize(void) {
+    ir_passes();
+    if (ir_select()) {
+        ir_passes();
+    }
+    if (ir_unroll()) {
+        ir_passes();
+    }
+}
+
+static const char* const IR_OPS[] = {
+    [IR_CONST] = "const",
+    [IR_PARAM] = "param",
+    [IR_PHI] = "phi",
+    [IR_LT] = "lt",
+    [IR_EQ] = "eq",
+    [IR_AND] = "and",
+    [IR_ADD] = "add",
+    [IR_SUB] = "sub",
+    [IR_MUL] = "mul",
+    [IR_SHR] = "shr",
+    [IR_SELECT] = "select",
+};
+
+static void value_println(u32 v) {
+    const IrValue* value = &IR_VALUES[v];
+    printf("        v%u = ", v);
+    switch (value->op) {
+    case IR_CONST: {
+        printf("%ld\n", value->imm);
+        return;
+    }
+    case IR_PARAM:
+    case IR_PHI: {
+        printf("%s %s", IR_OPS[value->op], insts_symbol(ESCAPES[value->local]));
+        break;
+    }
+    case IR_LT:
+    case IR_EQ:
+    case IR_AND:
+    case IR_ADD:
+    case IR_SUB:
+    case IR_MUL:
+    case IR_SHR:
+    case IR_SELECT: {
+        printf("%s", IR_OPS[value->op]);
+        break;
+    }
+    default: {
+        EXIT();
+    }
+    }
+    const u32 len_args = ir_len_args(value);
+    for (u32 i = 0; i < len_args; ++i) {
+        printf("%sv%u", i == 0 ? "(" : ", ", value->args[i]);
+    }
+    printf(len_args == 0 ? "\n" : ")\n");
+}
+
+void ir_show(void) {
+    putchar('\n');
+    for (u32 i = 0; i < LEN_IR_BLOCKS; ++i) {
+        const IrBlock* block = &IR_BLOCKS[i];
+        if (!block->reachable) {
+            continue;
+        }
+        printf("    b%u", i);
+        if (block->label != NULL) {
+            printf(" (%s)", block->label);
+        }
+        for (u32 j = 0; j < block->len_preds; ++j) {
+            printf("%sb%u", j == 0 ? " <- " : ", ", block->preds[j]);
+        }
+        if (i != 0) {
+            printf(", idom b%u", block->idom);
+        }
+        printf(":\n");
+        for (u32 j = 0; j < block->len_values; ++j) {
+            value_println(block->values[j]);
+        }
+        switch (block->term) {
+        case IR_JMP: {
+            printf("        jmp b%u\n", block->succs[0]);
+            break;
+        }
+        case IR_JZ: {
+            printf("        jz v%u, b%u, b%u\n",
+                   block->cond,
+                   block->succs[1],
+                   block->succs[0]);
+            break;
+        }
+        case IR_EXIT: {
+            printf("        exit %u", block->exit);
+            for (u32 j = 0; j < LEN_ESCAPES; ++j) {
+                const IrValue* value = &IR_VALUES[block->outs[j]];
+                if ((value->op != IR_PARAM) || (value->local != j)) {
+                    printf(", %s = v%u",
+                           insts_symbol(ESCAPES[j]),
+                           block->outs[j]);
+                }
+            }
+            putchar('\n');
+            break;
+        }
+        default: {
+            EXIT();
+        }
+        }
+    }
+}
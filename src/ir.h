@@ -0,0 +1,106 @@
+#ifndef IR_H
+#define IR_H
+
+#include "expr.h"
+
+// NOTE: Rounds of `IR_PASSES` that `ir_optimize` runs at most; `0` runs
+// none of them.
+#ifndef IR_ROUNDS
+    #define IR_ROUNDS 4
+#endif
+
+// NOTE: How many copies of a loop body `ir_unroll` makes at most; `1` leaves
+// every loop as it is. A body with many values gets fewer, so that the
+// copies come to no more than `UNROLL_VALUES` values in all.
+#ifndef IR_UNROLL
+    #define IR_UNROLL 4
+#endif
+
+#define UNROLL_VALUES 64
+
+// NOTE: `ir_select` computes both sides of a diamond only if they come to no
+// more than `SELECT_VALUES` values, and only if neither side ran less than
+// one time in `SELECT_BIAS`, when the branch predicts well.
+#define SELECT_VALUES 8
+#define SELECT_BIAS   8
+
+typedef enum {
+    IR_CONST = 0,
+
+    // NOTE: A local's value on entry, read from the frame.
+    IR_PARAM,
+    IR_PHI,
+
+    IR_LT,
+    IR_EQ,
+
+    IR_AND,
+
+    IR_ADD,
+
+    // NOTE: Never in a program; only `ir_scev` makes these. `IR_SHR` always
+    // shifts by a constant.
+    IR_SUB,
+    IR_MUL,
+    IR_SHR,
+
+    // NOTE: Only `ir_select` makes these; the second operand if the first is
+    // non-zero, and the third otherwise.
+    IR_SELECT,
+} IrOp;
+
+// NOTE: An SSA value. `args` are indices into `IR_VALUES`; two for a binary
+// operator, three for a select, and one per predecessor of `block`, in the
+// order of its `preds`, for a phi. `local` is an index into `ESCAPES`.
+typedef struct {
+    i64  imm;
+    u32* args;
+    u32  local;
+    u32  block;
+    IrOp op;
+} IrValue;
+
+typedef enum {
+    IR_JMP = 0,
+    IR_JZ,
+    IR_EXIT,
+} IrTerm;
+
+// NOTE: `succs[0]` is where a `JMP` goes, and where a `JZ` goes when `cond`
+// is non-zero; `succs[1]` is where it goes otherwise. `outs` holds the value
+// of every local on the way out, and `exit` is the instruction an `EXIT`
+// resumes at. No edge runs from a block with two successors to one with two
+// predecessors, so a copy on any edge has a block to go in. `runs` is how
+// often the interpreter ran the block before it was compiled, as far as
+// `JUMPS` tells; `0` for one `ir_build` made up.
+typedef struct {
+    const char* label;
+    u32*        values;
+    u32*        preds;
+    u32*        outs;
+    u32         succs[2];
+    u32         len_values;
+    u32         len_preds;
+    u32         cond;
+    u32         exit;
+    u32         idom;
+    u32         runs;
+    Bool        reachable;
+    IrTerm      term;
+} IrBlock;
+
+u32  ir_build(void);
+void ir_optimize(void);
+void ir_show(void);
+u32  ir_len_args(const IrValue*);
+u32  ir_len_succs(const IrBlock*);
+
+// NOTE: Built from `LIST` by `ir_build`. Block `0` is the entry, which
+// reads every local and falls into the first statement.
+extern IrBlock* IR_BLOCKS;
+extern u32      LEN_IR_BLOCKS;
+
+extern IrValue* IR_VALUES;
+extern u32      LEN_IR_VALUES;
+
+#endif
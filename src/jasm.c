@@ -0,0 +1,12 @@
+#include "asm.h"
+#include "bytecode.h"
+
+i32 main(i32 argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <input.jasm> <output.jbc>\n", argv[0]);
+        return ERROR;
+    }
+    bytecode_assemble(argv[1]);
+    bytecode_write(argv[2]);
+    return OK;
+}
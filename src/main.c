@@ -1,24 +1,17 @@
 #include "asm.h"
+#include "bytecode.h"
+#include "cache.h"
 
 // NOTE: See `https://www.cs.cmu.edu/~rjsimmon/15411-f15/lec/10-ssa.pdf`.
 // NOTE: See `http://troubles.md/wasm-is-not-a-stack-machine/`.
 
-u32 JUMPS[CAP_INSTS] = {0};
-u32 LOOPS[CAP_INSTS] = {0};
-
-const char* ESCAPES[CAP_ESCAPES];
-u32         LEN_ESCAPES = 0;
-
-const Expr* LIST[CAP_LIST];
-u32         LEN_LIST = 0;
-
 #define INST_EMPTY(inst_type) ((Inst){.type = inst_type})
 #define INST_I64(inst_type, inst_arg) \
     ((Inst){.type = inst_type, .value = {.as_i64 = inst_arg}})
 #define INST_CHARS(inst_type, inst_arg) \
     ((Inst){.type = inst_type, .value = {.as_chars = inst_arg}})
 
-static Inst INSTS[] = {
+static const Inst INSTS[] = {
     INST_I64(INST_PUSH, 0),
     INST_CHARS(INST_ALLOC, "x"),
 
@@ -60,33 +53,28 @@ static Inst INSTS[] = {
 
 #define LEN_INSTS (sizeof(INSTS) / sizeof(INSTS[0]))
 
-i32 main(void) {
-    insts_setup(INSTS, LEN_INSTS);
-    insts_run(INSTS);
-    insts_show();
-
-    for (u32 i = 0; i < LEN_INSTS; ++i) {
-        if (LOOPS[i] == 0) {
-            continue;
-        }
-
-        const u32 start = i;
-        const u32 end = LOOPS[i] + 2;
-        EXIT_IF(LEN_INSTS < end);
-
-        printf("\n%u -> %u\n", start, end);
-
-        exprs_parse(INSTS, start, end);
-        exprs_show();
-
-        asm_emit();
-        asm_show();
-
-        void (*func)(i64*) = (void (*)(i64*))asm_jit();
-
-        i64 x = 0;
-        func(&x);
-        printf("%ld\n", x);
+// NOTE: `main [-q] [program.jbc [cache]]`; `-q` leaves out the dumps, so
+// only what the program itself prints is left.
+i32 main(i32 argc, char** argv) {
+    const Bool quiet = (2 <= argc) && eq(argv[1], "-q");
+    if (quiet) {
+        --argc;
+        ++argv;
+    }
+    if (argc == 3) {
+        cache_open(argv[2]);
+    }
+    if (2 <= argc) {
+        EXIT_IF(3 < argc);
+        bytecode_load(argv[1]);
+    } else {
+        EXIT_IF(argc != 1);
+        insts_setup(INSTS, LEN_INSTS);
+    }
+    INSTS_SHOW = !quiet;
+    insts_run();
+    if (!quiet) {
+        insts_show();
     }
 
     return OK;
@@ -14,6 +14,8 @@ typedef uint64_t u64;
 typedef int32_t i32;
 typedef int64_t i64;
 
+typedef double f64;
+
 #define OK    0
 #define ERROR 1
 
@@ -0,0 +1,86 @@
+#include "table.h"
+
+// NOTE: The multiply is widened so it never wraps.
+u32 hash_bytes(u32 hash, const void* bytes, u64 len_bytes) {
+    for (u64 i = 0; i < len_bytes; ++i) {
+        hash ^= ((const u8*)bytes)[i];
+        hash = (u32)(((u64)hash * 16777619) & 0xFFFFFFFF);
+    }
+    return hash;
+}
+
+u32 hash_word(u32 hash, u64 word) {
+    for (u32 i = 0; i < 8; ++i) {
+        hash ^= (u32)((word >> (8 * i)) & 0xFF);
+        hash = (u32)(((u64)hash * 16777619) & 0xFFFFFFFF);
+    }
+    return hash;
+}
+
+static u32 table_hash(const char* key) {
+    return hash_bytes(HASH_SEED, key, len(key));
+}
+
+static TableEntry* table_slot(const Table* table, const char* key, u32 hash) {
+    for (u32 i = hash & (table->cap - 1);; i = (i + 1) & (table->cap - 1)) {
+        TableEntry* entry = &table->entries[i];
+        if ((entry->key == NULL) ||
+            ((entry->hash == hash) && eq(entry->key, key)))
+        {
+            return entry;
+        }
+    }
+}
+
+static void table_alloc(Table* table, u32 cap) {
+    table->entries = ARENA_ALLOC(table->arena, TableEntry, cap);
+    table->cap = cap;
+    for (u32 i = 0; i < cap; ++i) {
+        table->entries[i].key = NULL;
+    }
+}
+
+// NOTE: `len` is a hint; the table starts with room for that many keys.
+void table_init(Table* table, Arena* arena, u32 len) {
+    u32 cap = 1 << 3;
+    for (; cap < (len * 2lu); cap <<= 1) {
+        EXIT_IF((1u << 31) <= cap);
+    }
+    table->arena = arena;
+    table->len = 0;
+    table_alloc(table, cap);
+}
+
+// NOTE: Returns `FALSE`, and leaves the table alone, if `key` is present.
+Bool table_insert(Table* table, const char* key, u32 value) {
+    if (table->cap <= (table->len * 2lu)) {
+        EXIT_IF((1u << 31) <= table->cap);
+        const TableEntry* entries = table->entries;
+        const u32         cap = table->cap;
+        table_alloc(table, cap << 1);
+        for (u32 i = 0; i < cap; ++i) {
+            if (entries[i].key != NULL) {
+                *table_slot(table, entries[i].key, entries[i].hash) =
+                    entries[i];
+            }
+        }
+    }
+
+    const u32   hash = table_hash(key);
+    TableEntry* entry = table_slot(table, key, hash);
+    if (entry->key != NULL) {
+        return FALSE;
+    }
+    *entry = (TableEntry){
+        .key = key,
+        .hash = hash,
+        .value = value,
+    };
+    ++table->len;
+    return TRUE;
+}
+
+u32* table_find(Table* table, const char* key) {
+    TableEntry* entry = table_slot(table, key, table_hash(key));
+    return entry->key == NULL ? NULL : &entry->value;
+}
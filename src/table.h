@@ -0,0 +1,34 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include "arena.h"
+
+// NOTE: Open-addressed, linearly probed map from a string to a `u32`. Entries
+// live in the given arena and the table doubles whenever it is half full, so
+// it goes away with that arena's next reset.
+typedef struct {
+    const char* key;
+    u32         hash;
+    u32         value;
+} TableEntry;
+
+typedef struct {
+    Arena*      arena;
+    TableEntry* entries;
+    u32         len;
+    u32         cap;
+} Table;
+
+// NOTE: 32-bit FNV-1a. A hash starts at `HASH_SEED`, and each call folds
+// more bytes into it; `hash_word` folds the eight bytes of a `u64`, lowest
+// first.
+#define HASH_SEED ((u32)2166136261)
+
+u32 hash_bytes(u32, const void*, u64);
+u32 hash_word(u32, u64);
+
+void table_init(Table*, Arena*, u32);
+Bool table_insert(Table*, const char*, u32);
+u32* table_find(Table*, const char*);
+
+#endif